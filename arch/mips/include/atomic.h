@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _MIPS_ATOMIC_H_
+#define _MIPS_ATOMIC_H_
+
+/*
+ * MIPS atomic operations, using LL/SC. Each retries until its SC
+ * succeeds. The "memory" clobbers keep the compiler from moving other
+ * memory accesses across them.
+ *
+ * See <atomic.h> for the interface. spinlock_ptr_swap and
+ * spinlock_ptr_cas in <machine/spinlock.h> are built on these too.
+ */
+
+uint32_t atomic_load(const volatile uint32_t *p);
+void atomic_store(volatile uint32_t *p, uint32_t val);
+uint32_t atomic_add(volatile uint32_t *p, uint32_t n);
+uint32_t atomic_swap(volatile uint32_t *p, uint32_t val);
+bool atomic_cas(volatile uint32_t *p, uint32_t oldval, uint32_t newval);
+uint32_t atomic_or(volatile uint32_t *p, uint32_t bits);
+uint32_t atomic_and(volatile uint32_t *p, uint32_t bits);
+
+////////////////////////////////////////////////////////////
+
+ATOMIC_INLINE
+uint32_t
+atomic_load(const volatile uint32_t *p)
+{
+	return *p;
+}
+
+ATOMIC_INLINE
+void
+atomic_store(volatile uint32_t *p, uint32_t val)
+{
+	*p = val;
+}
+
+ATOMIC_INLINE
+uint32_t
+atomic_add(volatile uint32_t *p, uint32_t n)
+{
+	uint32_t x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"addu %1, %0, %3;"	/*   y = x + n */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (p), "r" (n) : "memory");
+	} while (y == 0);
+	return x + n;
+}
+
+ATOMIC_INLINE
+uint32_t
+atomic_swap(volatile uint32_t *p, uint32_t val)
+{
+	uint32_t x, y;
+
+	do {
+		y = val;
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "+r" (y) : "r" (p) : "memory");
+	} while (y == 0);
+	return x;
+}
+
+ATOMIC_INLINE
+bool
+atomic_cas(volatile uint32_t *p, uint32_t oldval, uint32_t newval)
+{
+	uint32_t x, y;
+
+	/*
+	 * If *p isn't OLDVAL, branch past the SC; Y is cleared in the
+	 * delay slot either way and only set if we get as far as the
+	 * SC and it succeeds.
+	 */
+	while (1) {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			".set noreorder;"	/* we fill the delay slot */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"bne %0, %3, 1f;"	/*   if (x != oldval) fail */
+			"move %1, $0;"		/*   y = 0 (delay slot) */
+			"move %1, %4;"		/*   y = newval */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			"1:"
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (p), "r" (oldval), "r" (newval)
+			: "memory");
+		if (x != oldval) {
+			return false;
+		}
+		if (y != 0) {
+			return true;
+		}
+	}
+}
+
+ATOMIC_INLINE
+uint32_t
+atomic_or(volatile uint32_t *p, uint32_t bits)
+{
+	uint32_t x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"or %1, %0, %3;"	/*   y = x | bits */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (p), "r" (bits) : "memory");
+	} while (y == 0);
+	return x;
+}
+
+ATOMIC_INLINE
+uint32_t
+atomic_and(volatile uint32_t *p, uint32_t bits)
+{
+	uint32_t x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"and %1, %0, %3;"	/*   y = x & bits */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (p), "r" (bits) : "memory");
+	} while (y == 0);
+	return x;
+}
+
+
+#endif /* _MIPS_ATOMIC_H_ */
@@ -31,6 +31,7 @@
 #define _MIPS_SPINLOCK_H_
 
 #include <cdefs.h>
+#include <atomic.h>
 
 
 /* Type of value needed to actually spin on */
@@ -44,6 +45,10 @@ void spinlock_data_set(volatile spinlock_data_t *sd, unsigned val);
 spinlock_data_t spinlock_data_get(volatile spinlock_data_t *sd);
 spinlock_data_t spinlock_data_testandset(volatile spinlock_data_t *sd);
 
+/* Atomic operations on pointers, for MCS locks */
+void *spinlock_ptr_swap(void *volatile *p, void *val);
+bool spinlock_ptr_cas(void *volatile *p, void *oldval, void *newval);
+
 ////////////////////////////////////////////////////////////
 
 SPINLOCK_INLINE
@@ -93,5 +98,25 @@ spinlock_data_testandset(volatile spinlock_data_t *sd)
 	return x;
 }
 
+/*
+ * The pointer operations are the 32-bit ones from <atomic.h>, so
+ * there's only one set of LL/SC sequences to get right; pointers are
+ * 32 bits here.
+ */
+
+SPINLOCK_INLINE
+void *
+spinlock_ptr_swap(void *volatile *p, void *val)
+{
+	return (void *)atomic_swap((volatile uint32_t *)p, (uint32_t)val);
+}
+
+SPINLOCK_INLINE
+bool
+spinlock_ptr_cas(void *volatile *p, void *oldval, void *newval)
+{
+	return atomic_cas((volatile uint32_t *)p, (uint32_t)oldval,
+			  (uint32_t)newval);
+}
 
 #endif /* _MIPS_SPINLOCK_H_ */
@@ -194,6 +194,24 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+		/*
+		 * If another thread of this process has called
+		 * _exit, leave instead of going back to user mode.
+		 * This is what stops compute-bound threads.
+		 *
+		 * Leaving sleeps, so it needs interrupts on; the
+		 * recorded state is already spl 0, as in user mode,
+		 * so just turn them on in the processor. In case
+		 * it ever comes back, turn them off again: the
+		 * return path below expects them off.
+		 */
+		if (!iskern && uthread_exiting()) {
+			KASSERT(curthread->t_curspl == 0);
+			cpu_irqon();
+			uthread_checkexit();
+			cpu_irqoff();
+		}
 		goto done2;
 	}
 
@@ -314,6 +332,10 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	if (!iskern) {
+		uthread_checkexit();
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -429,3 +451,24 @@ enter_new_process(int argc, userptr_t argv, vaddr_t stack, vaddr_t entry)
 
 	mips_usermode(&tf);
 }
+
+/*
+ * enter_new_thread: go to user mode in a thread made by thread_create.
+ *
+ * Like enter_new_process, but the one argument goes in a0, and the
+ * address space is already set up and shared with other threads.
+ */
+void
+enter_new_thread(vaddr_t arg, vaddr_t stack, vaddr_t entry)
+{
+	struct trapframe tf;
+
+	bzero(&tf, sizeof(tf));
+
+	tf.tf_status = CST_IRQMASK | CST_IEp | CST_KUp;
+	tf.tf_epc = entry;
+	tf.tf_a0 = arg;
+	tf.tf_sp = stack;
+
+	mips_usermode(&tf);
+}
@@ -31,10 +31,197 @@
 #include <kern/errno.h>
 #include <kern/syscall.h>
 #include <lib.h>
+#include <spl.h>
+#include <atomic.h>
+#include <percpu.h>
+#include <clock.h>
+#include <copyinout.h>
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
+#include "opt-A2.h"
+
+/*
+ * The system call table.
+ *
+ * Each call has a small adapter (sc_<name>) that unpacks its argument
+ * words, in the order described below, into the arguments of the
+ * real handler. syscall() picks up the number of words the table
+ * says the call takes and times the adapter, so every call gets
+ * counted the same way.
+ */
+
+#define SYSCALL_NCALLS   128	/* Highest call number + 1 */
+#define SYSCALL_MAXARGS  6	/* Most argument words a call can take */
+
+struct syscallent {
+	int (*se_handler)(const uint32_t *args, int32_t *retval);
+	unsigned se_nargs;		/* Number of 32-bit argument words */
+	const char *se_name;
+};
+
+static
+int
+sc_reboot(const uint32_t *args, int32_t *retval)
+{
+	(void)retval;
+	return sys_reboot(args[0]);
+}
+
+static
+int
+sc___time(const uint32_t *args, int32_t *retval)
+{
+	(void)retval;
+	return sys___time((userptr_t)args[0], (userptr_t)args[1]);
+}
+
+static
+int
+sc_nanosleep(const uint32_t *args, int32_t *retval)
+{
+	(void)retval;
+	return sys_nanosleep((const_userptr_t)args[0], (userptr_t)args[1]);
+}
+
+static
+int
+sc_sched_setaffinity(const uint32_t *args, int32_t *retval)
+{
+	(void)retval;
+	return sys_sched_setaffinity(args[0]);
+}
+
+static
+int
+sc_sched_getaffinity(const uint32_t *args, int32_t *retval)
+{
+	(void)retval;
+	return sys_sched_getaffinity((userptr_t)args[0]);
+}
+
+static
+int
+sc_futex(const uint32_t *args, int32_t *retval)
+{
+	return sys_futex((userptr_t)args[0], args[1], args[2], retval);
+}
+
+static
+int
+sc_thread_create(const uint32_t *args, int32_t *retval)
+{
+	return sys_thread_create((userptr_t)args[0], (userptr_t)args[1],
+				 (userptr_t)args[2], retval);
+}
+
+static
+int
+sc_thread_exit(const uint32_t *args, int32_t *retval)
+{
+	(void)retval;
+	sys_thread_exit(args[0]);
+	panic("unexpected return from sys_thread_exit");
+	return 0;
+}
+
+static
+int
+sc_thread_join(const uint32_t *args, int32_t *retval)
+{
+	(void)retval;
+	return sys_thread_join(args[0], (userptr_t)args[1]);
+}
+
+#if OPT_A2
+static
+int
+sc_spawn(const uint32_t *args, int32_t *retval)
+{
+	return sys_spawn((userptr_t)args[0], (userptr_t)args[1],
+			 (userptr_t)args[2], args[3], (pid_t *)retval);
+}
+#endif
+
+#ifdef UW
+static
+int
+sc_write(const uint32_t *args, int32_t *retval)
+{
+	return sys_write((int)args[0], (userptr_t)args[1], (int)args[2],
+			 (int *)retval);
+}
+
+static
+int
+sc__exit(const uint32_t *args, int32_t *retval)
+{
+	(void)retval;
+	sys__exit((int)args[0]);
+	/* sys__exit does not return, execution should not get here */
+	panic("unexpected return from sys__exit");
+	return 0;
+}
+
+static
+int
+sc_getpid(const uint32_t *args, int32_t *retval)
+{
+	(void)args;
+	return sys_getpid((pid_t *)retval);
+}
+
+static
+int
+sc_waitpid(const uint32_t *args, int32_t *retval)
+{
+	return sys_waitpid((pid_t)args[0], (userptr_t)args[1], (int)args[2],
+			   (pid_t *)retval);
+}
+#endif // UW
+
+#define SYSCALL(name, nargs) \
+	[SYS_##name] = { sc_##name, nargs, #name }
+
+static const struct syscallent syscalls[SYSCALL_NCALLS] = {
+	SYSCALL(reboot, 1),
+	SYSCALL(__time, 2),
+	SYSCALL(nanosleep, 2),
+	SYSCALL(sched_setaffinity, 1),
+	SYSCALL(sched_getaffinity, 1),
+	SYSCALL(futex, 3),
+	SYSCALL(thread_create, 3),
+	SYSCALL(thread_exit, 1),
+	SYSCALL(thread_join, 2),
+#if OPT_A2
+	SYSCALL(spawn, 4),
+#endif
+#ifdef UW
+	SYSCALL(write, 3),
+	SYSCALL(_exit, 1),
+	SYSCALL(getpid, 0),
+	SYSCALL(waitpid, 3),
+#endif
+	/* Add stuff here */
+};
+
+/*
+ * Per-call counters, kept per cpu so counting doesn't bounce a cache
+ * line between cpus on every system call. ss_calls is bumped
+ * atomically on the way in, so calls that never return (_exit) are
+ * still counted; the rest are updated on the way out with interrupts
+ * off. Times are in nanoseconds, measured across the handler.
+ */
+struct syscallstat {
+	uint32_t ss_calls;
+	uint32_t ss_errors;
+	uint64_t ss_nsecs;
+	uint64_t ss_maxnsecs;
+};
+
+static PERCPU_DEFINE(struct syscallstat, syscallstats)[SYSCALL_NCALLS] =
+	{ { 0, 0, 0, 0 } };
 
 
 /*
@@ -74,7 +261,55 @@
  * values) further arguments must be fetched from the user-level
  * stack, starting at sp+16 to skip over the slots for the
  * registerized values, with copyin().
+ *
+ * The handler and how many argument words to fetch come from the
+ * syscalls[] table above.
  */
+static
+int
+syscall_dispatch(struct trapframe *tf, int callno, int32_t *retval)
+{
+	const struct syscallent *se = &syscalls[callno];
+	uint32_t args[SYSCALL_MAXARGS];
+	struct syscallstat *ss;
+	uint64_t start, nsecs;
+	int err, spl;
+
+	KASSERT(se->se_nargs <= SYSCALL_MAXARGS);
+
+	args[0] = tf->tf_a0;
+	args[1] = tf->tf_a1;
+	args[2] = tf->tf_a2;
+	args[3] = tf->tf_a3;
+
+	atomic_inc(&PERCPU_CUR(syscallstats)[callno].ss_calls);
+	start = getnsecs();
+
+	err = 0;
+	if (se->se_nargs > 4) {
+		err = copyin((const_userptr_t)(tf->tf_sp + 16), &args[4],
+			     (se->se_nargs - 4) * sizeof(args[0]));
+	}
+	if (!err) {
+		err = se->se_handler(args, retval);
+	}
+
+	/* We may be on a different cpu by now; count it on this one. */
+	nsecs = getnsecs() - start;
+	spl = splhigh();
+	ss = &PERCPU_CUR(syscallstats)[callno];
+	if (err) {
+		ss->ss_errors++;
+	}
+	ss->ss_nsecs += nsecs;
+	if (nsecs > ss->ss_maxnsecs) {
+		ss->ss_maxnsecs = nsecs;
+	}
+	splx(spl);
+
+	return err;
+}
+
 void
 syscall(struct trapframe *tf)
 {
@@ -99,46 +334,14 @@ syscall(struct trapframe *tf)
 
 	retval = 0;
 
-	switch (callno) {
-	    case SYS_reboot:
-		err = sys_reboot(tf->tf_a0);
-		break;
-
-	    case SYS___time:
-		err = sys___time((userptr_t)tf->tf_a0,
-				 (userptr_t)tf->tf_a1);
-		break;
-#ifdef UW
-	case SYS_write:
-	  err = sys_write((int)tf->tf_a0,
-			  (userptr_t)tf->tf_a1,
-			  (int)tf->tf_a2,
-			  (int *)(&retval));
-	  break;
-	case SYS__exit:
-	  sys__exit((int)tf->tf_a0);
-	  /* sys__exit does not return, execution should not get here */
-	  panic("unexpected return from sys__exit");
-	  break;
-	case SYS_getpid:
-	  err = sys_getpid((pid_t *)&retval);
-	  break;
-	case SYS_waitpid:
-	  err = sys_waitpid((pid_t)tf->tf_a0,
-			    (userptr_t)tf->tf_a1,
-			    (int)tf->tf_a2,
-			    (pid_t *)&retval);
-	  break;
-#endif // UW
-
-	    /* Add stuff here */
- 
-	default:
-	  kprintf("Unknown syscall %d\n", callno);
-	  err = ENOSYS;
-	  break;
+	if (callno < 0 || callno >= SYSCALL_NCALLS ||
+	    syscalls[callno].se_handler == NULL) {
+		kprintf("Unknown syscall %d\n", callno);
+		err = ENOSYS;
+	}
+	else {
+		err = syscall_dispatch(tf, callno, &retval);
 	}
-
 
 	if (err) {
 		/*
@@ -168,6 +371,87 @@ syscall(struct trapframe *tf)
 	KASSERT(curthread->t_iplhigh_count == 0);
 }
 
+/*
+ * Print the system call counters, added up over all cpus, busiest
+ * (by total time) first. Like the scheduler stats, they're read
+ * without stopping the cpus updating them.
+ */
+void
+syscall_printstats(void)
+{
+	struct syscallstat *tot, tmp;
+	const char *name, **names;
+	struct syscallstat *ss;
+	struct cpu *c;
+	unsigned num, i, j, k;
+
+	tot = kmalloc(SYSCALL_NCALLS * sizeof(*tot));
+	names = kmalloc(SYSCALL_NCALLS * sizeof(*names));
+	if (tot == NULL || names == NULL) {
+		kfree(tot);
+		kfree(names);
+		kprintf("syscall_printstats: Out of memory\n");
+		return;
+	}
+
+	num = 0;
+	for (i=0; i<SYSCALL_NCALLS; i++) {
+		name = syscalls[i].se_name;
+		if (name == NULL) {
+			continue;
+		}
+		bzero(&tmp, sizeof(tmp));
+		PERCPU_FOREACH(c, j) {
+			ss = &PERCPU(syscallstats, c)[i];
+			tmp.ss_calls += ss->ss_calls;
+			tmp.ss_errors += ss->ss_errors;
+			tmp.ss_nsecs += ss->ss_nsecs;
+			if (ss->ss_maxnsecs > tmp.ss_maxnsecs) {
+				tmp.ss_maxnsecs = ss->ss_maxnsecs;
+			}
+		}
+		if (tmp.ss_calls == 0) {
+			continue;
+		}
+
+		/* Insertion sort, most total time first. */
+		for (k=num; k>0 && tot[k-1].ss_nsecs < tmp.ss_nsecs; k--) {
+			tot[k] = tot[k-1];
+			names[k] = names[k-1];
+		}
+		tot[k] = tmp;
+		names[k] = name;
+		num++;
+	}
+
+	kprintf("%-18s %10s %8s %10s %8s %8s\n", "syscall", "calls",
+		"errors", "total(us)", "avg(us)", "max(us)");
+	for (i=0; i<num; i++) {
+		kprintf("%-18s %10u %8u %10llu %8llu %8llu\n", names[i],
+			tot[i].ss_calls, tot[i].ss_errors,
+			tot[i].ss_nsecs / 1000,
+			tot[i].ss_nsecs / 1000 / tot[i].ss_calls,
+			tot[i].ss_maxnsecs / 1000);
+	}
+	kfree(names);
+	kfree(tot);
+}
+
+/*
+ * Clear the system call counters. Counts from calls in progress may
+ * survive, as with thread_resetsched.
+ */
+void
+syscall_resetstats(void)
+{
+	struct cpu *c;
+	unsigned i;
+
+	PERCPU_FOREACH(c, i) {
+		bzero(PERCPU(syscallstats, c), sizeof(percpu__syscallstats));
+	}
+}
+
 /*
  * Enter user mode for a newly forked process.
  *
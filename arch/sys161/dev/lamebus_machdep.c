@@ -242,6 +242,27 @@ mainbus_send_ipi(struct cpu *target)
 	lamebus_assert_ipi(lamebus, target);
 }
 
+/*
+ * Stop and restart the on-chip timer, for tickless idle.
+ *
+ * The count register can't be stopped, but writing the compare
+ * register restarts the count, so setting the compare register as
+ * far out as it goes (a bit under three minutes at 25 MHz) is as good
+ * as stopping it. If the timer does go off that late on an idle cpu,
+ * hardclock will just stop it again.
+ */
+void
+mainbus_stop_hardclock(void)
+{
+	mips_timer_set(0xffffffff);
+}
+
+void
+mainbus_start_hardclock(void)
+{
+	mips_timer_set(CPU_FREQUENCY / HZ);
+}
+
 /*
  * Interrupt dispatcher.
  */
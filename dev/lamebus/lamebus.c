@@ -615,7 +615,7 @@ lamebus_init(void)
 		panic("lamebus_init: Out of memory\n");
 	}
 
-	spinlock_init(&lamebus->ls_lock);
+	spinlock_init_mcs(&lamebus->ls_lock);
 
 	/*
 	 * Initialize the LAMEbus data structure.
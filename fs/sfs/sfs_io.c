@@ -33,8 +33,16 @@
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <clock.h>
 #include <sfs.h>
 
+/*
+ * Delay before retrying a failed I/O; doubles with each retry, up to
+ * SFS_RETRY_MAXSHIFT doublings (640 ms).
+ */
+#define SFS_RETRY_NS		5000000		/* 5 ms */
+#define SFS_RETRY_MAXSHIFT	7
+
 ////////////////////////////////////////////////////////////
 //
 // Basic block-level I/O routines
@@ -74,6 +82,13 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 			goto retry;
 		}
 		else if (tries < 10) {
+			/*
+			 * Back off rather than hammering a device that's
+			 * having trouble. (The first retry is immediate,
+			 * in case it was a one-off.)
+			 */
+			thread_sleep_ns(SFS_RETRY_NS << (tries < SFS_RETRY_MAXSHIFT ?
+					tries : SFS_RETRY_MAXSHIFT));
 			tries++;
 			goto retry;
 		}
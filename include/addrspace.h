@@ -91,6 +91,9 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_translate - find the physical address a virtual address maps
+ *                to. Returns EFAULT if it isn't mapped.
  */
 
 struct addrspace *as_create(void);
@@ -107,6 +110,8 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_translate(struct addrspace *as, vaddr_t vaddr,
+                               paddr_t *ret);
 
 
 /*
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*
+ * Atomic operations on 32-bit words, for lock-free counters, flags,
+ * and queues. The guts are machine-dependent.
+ *
+ *    atomic_load(p)         - read *p.
+ *    atomic_store(p, v)     - set *p to V.
+ *    atomic_add(p, n)       - add N to *p; returns the new value.
+ *                             (N is unsigned, but adding (uint32_t)-1
+ *                             subtracts one, as you'd hope.)
+ *    atomic_inc(p)          - atomic_add(p, 1).
+ *    atomic_dec(p)          - subtract one; returns the new value.
+ *    atomic_swap(p, v)      - set *p to V; returns the old value.
+ *    atomic_cas(p, old, new) - if *p is OLD, set it to NEW and return
+ *                             true; otherwise return false.
+ *    atomic_or(p, bits)     - set BITS in *p; returns the old value.
+ *    atomic_and(p, bits)    - clear all but BITS in *p; returns the
+ *                             old value.
+ *
+ * Each is atomic with respect to the others on any cpu, and to
+ * interrupts. None of them is a hardware memory barrier; System/161
+ * doesn't reorder memory accesses, so none is needed there. See
+ * spinlock_ptr_swap and spinlock_ptr_cas in <spinlock.h> for pointers.
+ */
+
+#include <cdefs.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef ATOMIC_INLINE
+#define ATOMIC_INLINE INLINE
+#endif
+
+/* Get the machine-dependent bits. */
+#include <machine/atomic.h>
+
+#define atomic_inc(p)	atomic_add((p), 1)
+#define atomic_dec(p)	atomic_add((p), (uint32_t)-1)
+
+
+#endif /* _ATOMIC_H_ */
@@ -35,25 +35,35 @@
 /*
  * Time-related definitions.
  *
- * hardclock() is called on every CPU HZ times a second, possibly only
- * when the CPU is not idle, for scheduling.
+ * hardclock() is called on every CPU HZ times a second, for scheduling,
+ * while the CPU is not idle. An idle CPU stops its hardclock until it
+ * has something to run again.
  *
  * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * timed operations. (This is a fairly simpleminded interface; the
+ * timeouts below are finer-grained.)
  *
  * gettime() may be used to fetch the current time of day.
  * getinterval() computes the time from time1 to time2.
+ * getnsecs() returns the current time as a count of nanoseconds, for
+ * timing things; it returns 0 if called before the clock is attached.
  *
  * XXX we have struct timespec now, let's use it.
  */
 
-/* hardclocks per second */
+/*
+ * hardclocks per second, and the default scheduling quantum (in
+ * hardclocks) for threads that don't set their own with
+ * thread_setquantum().
+ */
 #if OPT_SYNCHPROBS
 /* Make synchronization more exciting :) */
 #define HZ  10000
+#define DEFAULT_QUANTUM  1
 #else
 /* More realistic value */
 #define HZ  100
+#define DEFAULT_QUANTUM  4
 #endif
 
 void hardclock_bootstrap(void);
@@ -62,6 +72,7 @@ void hardclock(void);
 void timerclock(void);
 
 void gettime(time_t *seconds, uint32_t *nanoseconds);
+uint64_t getnsecs(void);
 
 void getinterval(time_t secs1, uint32_t nsecs,
                  time_t secs2, uint32_t nsecs2,
@@ -73,5 +84,50 @@ void getinterval(time_t secs1, uint32_t nsecs,
  */
 void clocksleep(int seconds);
 
+/*
+ * Timeouts: one-shot callbacks run from hardclock() a given number
+ * of hardclocks in the future, on the cpu that scheduled them.
+ *
+ * The struct timeout is supplied by the caller and must stay put
+ * until it has fired or been cancelled. Both adding and cancelling
+ * are O(1). Callbacks run in interrupt context and must not sleep;
+ * they may re-add their own timeout.
+ *
+ * timeout_init() sets up a timeout to call FUNC(ARG).
+ * timeout_add() schedules it TICKS hardclocks from now (at least 1;
+ *     long delays are clamped to TIMEOUT_MAXTICKS), rescheduling it
+ *     if it was already pending.
+ * timeout_cancel() unschedules it, returning true if it was pending
+ *     and false if it had already fired (or is firing).
+ * timeout_pending() says whether it is currently scheduled.
+ *
+ * thread_sleep_ticks() and thread_sleep_ns() put the current thread
+ * to sleep for the given time, rounded up to whole hardclocks.
+ */
+#define NSEC_PER_HARDCLOCK  (1000000000 / HZ)
+#define TIMEOUT_MAXTICKS    ((1U << 24) - 1)
+
+struct timeoutwheel;		/* Opaque; one per cpu. */
+
+struct timeout {
+	void (*to_func)(void *);	/* Function to call */
+	void *to_arg;			/* Argument for it */
+	unsigned to_expire;		/* Hardclock count to fire at */
+	struct timeoutwheel *to_wheel;	/* Wheel it's on, or NULL */
+	struct timeout *to_next;	/* Links within the wheel slot */
+	struct timeout **to_pprev;
+};
+
+struct timeoutwheel *timeoutwheel_create(void);
+bool timeoutwheel_empty(struct timeoutwheel *tw);
+
+void timeout_init(struct timeout *to, void (*func)(void *), void *arg);
+void timeout_add(struct timeout *to, unsigned ticks);
+bool timeout_cancel(struct timeout *to);
+bool timeout_pending(struct timeout *to);
+
+void thread_sleep_ticks(unsigned ticks);
+void thread_sleep_ns(uint32_t nsecs);
+
 
 #endif /* _CLOCK_H_ */
@@ -46,6 +46,8 @@
  * a pointer with a fixed address and a per-cpu mapping in the MMU.
  */
 
+#define CPU_MCSNODES 8
+
 struct cpu {
 	/*
 	 * Fixed after allocation.
@@ -53,13 +55,27 @@ struct cpu {
 	struct cpu *c_self;		/* Canonical address of this struct */
 	unsigned c_number;		/* This cpu's cpu number */
 	unsigned c_hardware_number;	/* Hardware-defined cpu number */
+	void *c_percpu;			/* Per-cpu variables; see percpu.h */
 
 	/*
 	 * Accessed only by this cpu.
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_threadcache; /* Exited threads for reuse */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	unsigned c_switches;		/* Counter of context switches */
+	bool c_hardclock_stopped;	/* Timer stopped while idle */
+	unsigned c_mcsnodes_used;	/* Bitmap of c_mcsnodes in use */
+	struct thread *c_migrating;	/* Switched out to move elsewhere */
+
+	/*
+	 * Queue nodes for the MCS spinlocks this cpu holds or is
+	 * waiting for. Handed out by this cpu only, but written by
+	 * other cpus passing it a lock. One is needed per MCS lock
+	 * held at once, so this bounds how deeply they can nest.
+	 */
+	struct spinlock_mcsnode c_mcsnodes[CPU_MCSNODES];
 
 	/*
 	 * Accessed by other cpus.
@@ -69,6 +85,26 @@ struct cpu {
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Accessed by other cpus, without locking.
+	 *
+	 * Threads other cpus have woken up to run here, waiting to be
+	 * moved to the run queue. A lock-free stack of threads linked
+	 * through t_wakenext, newest first; see thread_make_runnable.
+	 */
+	void *volatile c_wakeq;
+
+	/*
+	 * Set once by workqueue_bootstrap.
+	 */
+	struct workqueue *c_workqueue;	/* Deferred work for this cpu */
+
+	/*
+	 * Accessed by other cpus (to cancel timeouts).
+	 * Protected by the wheel's own lock.
+	 */
+	struct timeoutwheel *c_timeouts; /* Pending timeouts */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -109,6 +145,13 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * cpu_count returns the number of cpus; cpu_get returns the one with
+ * the given cpu number (0 through cpu_count()-1).
+ */
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned number);
+
 /*
  * Return a string describing the CPU type.
  */
@@ -162,6 +205,7 @@ void cpu_halt(void);
 #define IPI_OFFLINE		1	/* CPU is requested to go offline */
 #define IPI_UNIDLE		2	/* Runnable threads are available */
 #define IPI_TLBSHOOTDOWN	3	/* MMU mapping(s) need invalidation */
+#define IPI_WAKEUP		4	/* Woken threads are on c_wakeq */
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
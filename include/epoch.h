@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _EPOCH_H_
+#define _EPOCH_H_
+
+/*
+ * Epoch-based deferred reclamation, for lock-free readers.
+ *
+ * A reader brackets its use of shared objects with epoch_enter() and
+ * epoch_exit(). In between it may follow pointers to objects that a
+ * writer is concurrently unlinking, because the writer doesn't free
+ * them directly but with defer_free() (or epoch_call()), which waits
+ * until every cpu has passed a quiescent point - a context switch, or
+ * a hardclock that didn't interrupt a reader - so nobody can still
+ * be looking at them.
+ *
+ * Read sections are cheap (they just count on the current cpu) and
+ * may nest, but they must be short and must not sleep or yield: the
+ * thread is not preempted while in one. They may be used in interrupt
+ * handlers.
+ *
+ *    epoch_enter()        - start a read section.
+ *    epoch_exit()         - end it.
+ *    defer_free(ptr)      - kfree PTR once current readers are done.
+ *    epoch_call(f, arg)   - likewise, but call F(ARG) instead, from
+ *                           thread context (a workqueue).
+ *    epoch_synchronize()  - wait until current readers are done.
+ *
+ * defer_free and epoch_call never sleep, so they may be used with
+ * spinlocks held or in a read section. If they can't allocate memory
+ * to remember the request they return ENOMEM and do nothing else;
+ * the object is still the caller's, which (if it can sleep) may wait
+ * with epoch_synchronize and free it directly.
+ *
+ * epoch_quiescent and epoch_hardclock are for thread_switch and
+ * hardclock; epoch_reading tells hardclock not to preempt. They must
+ * be called with interrupts off.
+ */
+
+void epoch_enter(void);
+void epoch_exit(void);
+int defer_free(void *ptr);
+int epoch_call(void (*func)(void *), void *arg);
+void epoch_synchronize(void);
+
+bool epoch_reading(void);
+void epoch_quiescent(void);
+bool epoch_hardclock(void);
+
+
+#endif /* _EPOCH_H_ */
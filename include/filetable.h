@@ -15,14 +15,22 @@ struct File{
 	int flags; // readable/writable
 	unsigned int fdesc;
 	volatile off_t offset;
-    struct lock* rw_lock;
+    struct lock* rw_lock; // serializes I/O and the offset
+	volatile uint32_t refcount; // table slots plus I/O in progress; atomic
 };
 
 #endif
+/*
+ * A process's threads share its table, so ft_lock covers files[],
+ * num_files and bm. To use a File without holding ft_lock, pin it
+ * with get_file and let go with release_file; a close meanwhile only
+ * drops the table's reference.
+ */
 struct FileTable{
 	struct File *files[OPEN_MAX];
 	unsigned int num_files;
 	struct bitmap *bm;
+	struct lock *ft_lock;
 };
 
 struct FileTable *create_filetable(void);
@@ -34,7 +42,10 @@ int duplicate_filetable(struct FileTable * src, struct FileTable * dest);
 int create_file_and_add_to_table(struct FileTable * ft, struct vnode *vn, int flags, int * fd);
 int file_exists_in_table(struct FileTable * ft, unsigned int fd);
 int close_file_and_remove_from_table(struct FileTable * ft, unsigned int fd);
+int share_file_with_table(struct FileTable * src, unsigned int srcfd, struct FileTable * dest, unsigned int destfd);
 
 int get_file_by_id(struct FileTable * ft, unsigned int fd, struct File * ret);
+struct File *get_file(struct FileTable * ft, unsigned int fd);
+void release_file(struct File * f);
 
 #endif
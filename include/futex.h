@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+struct proc;  /* from <proc.h> */
+
+/*
+ * Futexes: sleeping and waking on a word of memory, for user-level
+ * synchronization (see <kern/futex.h>). A user lock only has to enter
+ * the kernel when it's contended.
+ *
+ * Waiters are keyed by the physical address of the word, hashed onto
+ * a fixed set of buckets. Each sleeps in the SQ_FUTEX sleep queues
+ * (see wchan.h) under its own key, so only those woken wake up.
+ *
+ * futex_bootstrap() sets up the buckets. Call once at boot.
+ * futex_wait() sleeps on the word at physical address ADDR if it
+ *     holds VAL; otherwise it returns EAGAIN at once. The check and
+ *     going to sleep are atomic with respect to futex_wake. Returns
+ *     EINTR if the calling thread's process is exiting.
+ * futex_wake() wakes up to N threads sleeping on ADDR, and returns
+ *     how many it woke.
+ * futex_interrupt() wakes the futex sleepers in process P, so they
+ *     can leave. For _exit (see uthread_exitall).
+ *
+ * ADDR must be 4-byte aligned and in RAM, and the page must stay
+ * there while anyone waits on it.
+ */
+
+void futex_bootstrap(void);
+int futex_wait(paddr_t addr, int32_t val);
+unsigned futex_wake(paddr_t addr, unsigned n);
+void futex_interrupt(struct proc *p);
+
+
+#endif /* _FUTEX_H_ */
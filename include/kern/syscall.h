@@ -197,6 +197,21 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- Scheduling --
+#define SYS_sched_setaffinity 121
+#define SYS_sched_getaffinity 122
+
+//                              -- Synchronization --
+#define SYS_futex        123
+
+//                              -- Threads --
+#define SYS_thread_create 124
+#define SYS_thread_exit  125
+#define SYS_thread_join  126
+
+//                              -- Processes, continued --
+#define SYS_spawn        127
+
 /*CALLEND*/
 
 
@@ -55,6 +55,10 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/* Stop or restart hardclock interrupts on the current cpu. */
+void mainbus_stop_hardclock(void);
+void mainbus_start_hardclock(void);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
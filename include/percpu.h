@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PERCPU_H_
+#define _PERCPU_H_
+
+/*
+ * Per-cpu variables.
+ *
+ * PERCPU_DEFINE(type, name) defines a variable of which each cpu gets
+ * its own copy, for counters and the like that would otherwise need
+ * a field in struct cpu. It must have an initializer, which every
+ * cpu's copy starts out as:
+ *
+ *      PERCPU_DEFINE(unsigned, nfoo) = 0;
+ *      PERCPU_DEFINE(unsigned, foohist)[16] = { 0 };
+ *
+ * PERCPU_DECLARE(type, name) declares one defined in another file.
+ *
+ * The definitions all go in the .percpu section (see the ldscript),
+ * which is just a template: cpu_create gives each cpu a copy of the
+ * whole section in c_percpu, and the variable itself is never used.
+ *
+ *    PERCPU(name, c)   - cpu C's copy, as an lvalue.
+ *    PERCPU_CUR(name)  - the current cpu's copy.
+ *
+ * Nothing stops the current thread being preempted and moved to
+ * another cpu while using PERCPU_CUR, so either raise the spl or
+ * make the update one atomic operation; e.g. for a counter,
+ *
+ *      atomic_inc(&PERCPU_CUR(nfoo));
+ *
+ * which is always right even if it ends up counting on a different
+ * cpu than it started on. To read a total, add up all the copies:
+ *
+ *      PERCPU_FOREACH(c, i) {
+ *              total += PERCPU(nfoo, c);
+ *      }
+ */
+
+#include <cpu.h>
+#include <current.h>
+
+extern char __percpu_start[], __percpu_end[];
+
+#define PERCPU_DEFINE(type, name) \
+	__attribute__((__section__(".percpu"))) type percpu__##name
+
+#define PERCPU_DECLARE(type, name) \
+	extern type percpu__##name
+
+#define PERCPU(name, c) \
+	(*(__typeof__(&percpu__##name)) \
+	 ((char *)(c)->c_percpu + ((char *)&percpu__##name - __percpu_start)))
+
+#define PERCPU_CUR(name)	PERCPU(name, curcpu)
+
+#define PERCPU_FOREACH(c, i) \
+	for ((i) = 0; (i) < cpu_count() && ((c) = cpu_get(i)) != NULL; (i)++)
+
+/* Allocate the per-cpu area for a new cpu. Called by cpu_create. */
+void *percpu_create(void);
+
+
+#endif /* _PERCPU_H_ */
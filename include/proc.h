@@ -49,14 +49,36 @@ struct vnode;
 struct semaphore;
 #endif // UW
 
-#if OPT_A2
-	#ifndef PROCINLINE
-	#define PROCINLINE INLINE
-	#endif
+/*
+ * User-level threads. A process starts with one thread (tid 0); the
+ * thread_create system call adds more, which share the address space
+ * and file table. The bookkeeping is allocated on the first
+ * thread_create, while the process still has only one thread, so
+ * single-threaded processes never pay for it. See
+ * syscall/thread_syscalls.c.
+ *
+ * A uthread record stays on the list after its thread exits until
+ * someone joins it, so the exit value can be collected.
+ */
+struct uthread {
+	unsigned ut_tid;		/* Thread id, unique in the process */
+	bool ut_exited;			/* Thread has called thread_exit */
+	bool ut_joining;		/* Someone is waiting in thread_join */
+	int ut_exitval;			/* Value passed to thread_exit */
+	vaddr_t ut_entry;		/* User entry point (for startup) */
+	vaddr_t ut_arg;			/* Argument to ut_entry */
+	vaddr_t ut_stack;		/* Initial user stack pointer */
+	struct uthread *ut_next;	/* Next on us_threads */
+};
 
-	DECLARRAY_BYTYPE(proctable, struct proc);
-	DEFARRAY_BYTYPE(proctable, struct proc, PROCINLINE)
-#endif
+struct uthreadset {
+	struct lock *us_lock;		/* Protects everything here */
+	struct cv *us_cv;		/* Signaled on every thread exit */
+	struct uthread *us_threads;	/* All unjoined threads */
+	unsigned us_nexttid;		/* Next tid to hand out */
+	unsigned us_live;		/* Threads not yet exited */
+	bool us_exiting;		/* _exit called; threads should leave */
+};
 
 /*
  * Process structure.
@@ -68,9 +90,17 @@ struct proc {
 	int exitcode;	//exitcode
 	bool is_exit;
 	struct proc *pproc;	//parent for fork
-	struct proctable p_children;
-	struct lock *p_waitpid;
-	struct cv *p_waitpid_cv;
+	struct proc *p_children;	/* First child */
+	struct proc *p_sibnext;		/* Next child of pproc */
+	struct proc **p_sibpprev;	/* Link pointing to us */
+	struct proc *p_zombies;		/* Exited children, oldest first */
+	struct proc **p_zombtail;	/* Link at the end of p_zombies */
+	struct proc *p_zombnext;	/* Next on pproc's p_zombies */
+	struct proc **p_zombpprev;	/* Link pointing to us */
+	volatile uint32_t p_waited;	/* Claimed by a proc_wait (atomic) */
+	unsigned p_nunclaimed;		/* Children no proc_wait has claimed */
+	struct lock *p_waitlock;	/* Protects p_zombies, p_nunclaimed */
+	struct cv *p_waitcv;		/* Signaled when a child exits */
 	struct FileTable *p_ft;
 	struct semaphore *p_sem;
 	bool stdio_reserve;
@@ -78,6 +108,7 @@ struct proc {
 	char *p_name;			/* Name of this process */
 	struct spinlock p_lock;		/* Lock for this structure */
 	struct threadarray p_threads;	/* Threads in this process */
+	struct uthreadset *p_uthreads;	/* User threads, or NULL if only one */
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
@@ -96,9 +127,32 @@ struct proc {
 
 
 #if OPT_A2
-	void kill_orphans(struct proc *p);
+	/*
+	 * Processes are found by pid in O(1) (see proc.c). A process
+	 * that exits while its parent is alive stays around as a
+	 * zombie, holding its pid and exit status, until the parent
+	 * collects them with proc_wait; if the parent goes first, its
+	 * children are orphaned and freed as soon as they exit.
+	 *
+	 * Exiting children are queued on their parent in exit order,
+	 * so collecting any one of them is O(1) and a waiting parent
+	 * is woken once per exit.
+	 *
+	 * proc_addchild makes CHILD a child of PARENT.
+	 * proc_wait collects an exited child of PARENT: PID, or any
+	 * child if PID is -1. It stores the child's pid in PIDRET and
+	 * its exit status in STATUS, and frees it. If OPTIONS has
+	 * WNOHANG and no such child has exited yet, PIDRET is set to
+	 * 0 instead; otherwise it waits. Returns ECHILD if PID isn't
+	 * a child of PARENT (or someone else is waiting for it), or
+	 * PARENT has no children, and EINTR if the process is exiting
+	 * (see uthread_exitall).
+	 */
 	bool is_proc_child(struct proc *p, pid_t child_pid);
 	struct proc *proc_pid_get(pid_t pid);
+	void proc_addchild(struct proc *parent, struct proc *child);
+	int proc_wait(struct proc *parent, pid_t pid, int options,
+		      pid_t *pidret, int *status);
 
 	struct lock;
 #endif
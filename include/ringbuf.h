@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _RINGBUF_H_
+#define _RINGBUF_H_
+
+/*
+ * Bounded lock-free ring buffer of pointers, for producer/consumer
+ * paths (device input, completions, and the like).
+ *
+ * Modes, chosen when the ring is created:
+ *
+ *    RINGBUF_SPSC - one producer and one consumer at a time. They
+ *                   only write their own index, so no atomic
+ *                   operations are needed.
+ *    RINGBUF_MPMC - any number of each, using a sequence number per
+ *                   slot (after Vyukov): a producer or consumer
+ *                   claims slots with atomic_cas on the tail or head
+ *                   index, then fills or empties them.
+ *
+ * Neither ever waits for anyone else, so both are safe to use from
+ * interrupt handlers. However, in MPMC mode a thread that's been
+ * interrupted between claiming slots and filling or emptying them
+ * makes those slots look empty or full to everyone else until it
+ * finishes. Add RINGBUF_INTR if the ring is shared with interrupt
+ * handlers and that matters: each operation then runs at splhigh, so
+ * the window never spans an interrupt on the same cpu.
+ *
+ * Functions:
+ *     ringbuf_create  - allocate a ring holding SIZE pointers (rounded
+ *                       up to a power of 2). Returns NULL on error.
+ *     ringbuf_destroy - destroy a ring; it should be empty.
+ *     ringbuf_put     - add PTR (not NULL) at the tail. Returns
+ *                       ENOSPC if the ring is full.
+ *     ringbuf_get     - remove and return the head; NULL if empty.
+ *     ringbuf_putn    - add up to N pointers from PTRS; returns how
+ *                       many were added.
+ *     ringbuf_getn    - remove up to N pointers into PTRS; returns
+ *                       how many were removed.
+ *     ringbuf_count   - number of pointers in the ring. Only a hint if
+ *                       others are using it at the same time.
+ *     ringbuf_size    - number of pointers it can hold.
+ *
+ * The batched versions claim their slots all at once, so the items
+ * of a batch are contiguous in the ring; this is what makes them
+ * cheaper than a loop of single operations.
+ */
+
+#define RINGBUF_SPSC	0x0	/* Single producer, single consumer */
+#define RINGBUF_MPMC	0x1	/* Multiple producers and consumers */
+#define RINGBUF_INTR	0x2	/* Raise spl around operations */
+
+struct ringbuf;  /* Opaque. */
+
+struct ringbuf *ringbuf_create(unsigned size, unsigned flags);
+void            ringbuf_destroy(struct ringbuf *rb);
+int             ringbuf_put(struct ringbuf *rb, void *ptr);
+void           *ringbuf_get(struct ringbuf *rb);
+unsigned        ringbuf_putn(struct ringbuf *rb, void *const *ptrs,
+                             unsigned n);
+unsigned        ringbuf_getn(struct ringbuf *rb, void **ptrs, unsigned n);
+unsigned        ringbuf_count(struct ringbuf *rb);
+unsigned        ringbuf_size(struct ringbuf *rb);
+
+
+#endif /* _RINGBUF_H_ */
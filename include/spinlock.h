@@ -36,6 +36,7 @@
  */
 
 #include <cdefs.h>
+#include "opt-lockstat.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -45,11 +46,29 @@
 /* Get the machine-dependent bits. */
 #include <machine/spinlock.h>
 
+/*
+ * Queue node for MCS spinlocks. Each waiter spins on its own node
+ * rather than on the lock, and the holder hands the lock directly to
+ * the next node in line when it releases. Nodes come from a small
+ * per-cpu pool; see spinlock.c.
+ */
+struct spinlock_mcsnode {
+	struct spinlock_mcsnode *volatile mn_next; /* Next waiter */
+	volatile unsigned mn_locked;	/* Set while we must keep waiting */
+};
+
 /*
  * Basic spinlock.
  *
  * Note that spinlocks are held by CPUs, not by threads.
  *
+ * A spinlock is either a plain test-and-set lock (the default) or,
+ * if initialized with spinlock_init_mcs, an MCS queue lock. The MCS
+ * kind costs a little more when uncontended, but under contention
+ * each release touches only the next waiter's cache line, and
+ * waiters get the lock in the order they arrived. Use it for locks
+ * many cpus fight over.
+ *
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
@@ -57,17 +76,36 @@
 struct spinlock {
 	volatile spinlock_data_t lk_lock; /* The memory word where we spin. */
 	struct cpu *lk_holder;		/* CPU holding this lock. */
+	bool lk_mcs;			/* Is this an MCS lock? */
+	void *volatile lk_tail;		/* MCS: last node in the queue */
+	struct spinlock_mcsnode *lk_node; /* MCS: holder's node */
+#if OPT_LOCKSTAT
+	/* Set by the holder, for lockstat; see lockstat.h */
+	const void *lk_stat_site;	/* Where it was acquired */
+	uint64_t lk_stat_acquired;	/* When it was acquired (ns) */
+	uint64_t lk_stat_wait;		/* How long that took (ns) */
+	bool lk_stat_contended;		/* Whether we had to wait */
+#endif
 };
 
 /*
- * Initializer for cases where a spinlock needs to be static or global.
+ * Initializers for cases where a spinlock needs to be static or global.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#if OPT_LOCKSTAT
+#define SPINLOCK_STAT_INITIALIZER , NULL, 0, 0, false
+#else
+#define SPINLOCK_STAT_INITIALIZER
+#endif
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
+				  false, NULL, NULL SPINLOCK_STAT_INITIALIZER }
+#define SPINLOCK_MCS_INITIALIZER { SPINLOCK_DATA_INITIALIZER, NULL, \
+				  true, NULL, NULL SPINLOCK_STAT_INITIALIZER }
 
 /*
  * Spinlock functions.
  *
  * init		Initialize the contents of a spinlock.
+ * init_mcs	Same, but make it an MCS lock.
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
@@ -77,6 +115,7 @@ struct spinlock {
  */
 
 void spinlock_init(struct spinlock *lk);
+void spinlock_init_mcs(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
@@ -65,6 +65,17 @@ void sem_destroy(struct semaphore *);
 void P(struct semaphore *);
 void V(struct semaphore *);
 
+/*
+ * Normally a woken waiter has to compete for the semaphore or lock
+ * with any thread that comes along before it gets to run, and may
+ * lose and go back to sleep, indefinitely under contention. If
+ * synch_handoff is true, V and lock_release instead give the count
+ * or the lock directly to the thread that has waited longest, which
+ * bounds waiting time at the cost of throughput (the lock is idle
+ * until that thread is scheduled). Off by default.
+ */
+extern bool synch_handoff;
+
 
 /*
  * Simple lock for mutual exclusion.
@@ -72,17 +83,27 @@ void V(struct semaphore *);
  * When the lock is created, no thread should be holding it. Likewise,
  * when the lock is destroyed, no thread should be holding it.
  *
- * The name field is for easier debugging. A copy of the name is
- * (should be) made internally.
+ * The name field is for easier debugging. Unlike semaphores, locks
+ * and CVs do not copy the name, so it should be a string constant.
+ * They have no wait channel either: waiters sleep in the hashed
+ * sleep queues (see wchan.h), keyed by the lock or CV's address, so
+ * each is a single small allocation.
  */
 struct lock {
-        char *lk_name;
+        const char *lk_name;
         // add what you need here
         #if OPT_A1
-        struct wchan *lk_wchan;
         struct spinlock lk_lock;
-        volatile struct thread *lk_holder;
+        struct thread *volatile lk_holder;
+        uint16_t lk_pi_waiters;         /* See lock_pi_block in synch.c */
+        uint16_t lk_pi_pri;
         #endif
+#if OPT_LOCKSTAT
+        /* Set by the holder, for lockstat; see lockstat.h */
+        uint64_t lk_stat_acquired;      /* When it was acquired (ns) */
+        uint64_t lk_stat_wait;          /* How long that took (ns) */
+        bool lk_stat_contended;         /* Whether we had to wait */
+#endif
         // (don't forget to mark things volatile as needed)
 };
 
@@ -104,6 +125,23 @@ void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 void lock_destroy(struct lock *);
 
+/*
+ * lock_acquire spins for a lock whose holder is running on another
+ * cpu, polling it up to lock_spin_budget times before giving up and
+ * sleeping. Setting it to 0 makes lock_acquire always sleep.
+ */
+#define LOCK_SPIN_DEFAULT 1000
+extern unsigned lock_spin_budget;
+
+/*
+ * If true (the default), a thread that has to sleep for a lock lends
+ * its priority to the holder, and along the chain if the holder is
+ * itself waiting for a lock, so a high-priority thread isn't held up
+ * by lower-priority threads that don't even hold the lock. See
+ * thread_setpriority.
+ */
+extern bool lock_priority_inheritance;
+
 
 /*
  * Condition variable.
@@ -115,16 +153,12 @@ void lock_destroy(struct lock *);
  * These CVs are expected to support Mesa semantics, that is, no
  * guarantees are made about scheduling.
  *
- * The name field is for easier debugging. A copy of the name is
- * (should be) made internally.
+ * As with locks, the name is not copied, and waiters sleep in the
+ * hashed sleep queues, so there is nothing here but the name.
  */
 
 struct cv {
-        char *cv_name;
-        #if OPT_A1
-        struct wchan *cv_wchan;
-        // (don't forget to mark things volatile as needed)
-        #endif
+        const char *cv_name;
 };
 
 struct cv *cv_create(const char *name);
@@ -147,5 +181,53 @@ void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
+/*
+ * Wait morphing: since the signaller holds the lock, a woken waiter
+ * would only go straight back to sleep in lock_acquire. If
+ * cv_wait_morphing is true (the default), cv_signal and cv_broadcast
+ * instead move waiters from the CV onto the lock's sleep queue, and
+ * each lock_release then wakes one of them. A broadcast to N waiters
+ * costs one wakeup per release rather than N at once.
+ */
+extern bool cv_wait_morphing;
+
+
+/*
+ * Reader-writer lock, for data that is read much more often than it
+ * is changed. Any number of readers can hold it at once, or one
+ * writer. Writers are preferred: once a writer is waiting, new
+ * readers wait behind it, so a stream of readers can't starve it.
+ * (This means a thread must not take the read lock recursively;
+ * if a writer arrives in between, that deadlocks.)
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+struct rwlock {
+        char *rw_name;
+        struct spinlock rw_lock;
+        struct wchan *rw_readwchan;     /* readers wait here */
+        struct wchan *rw_writewchan;    /* writers wait here */
+        unsigned rw_readers;            /* readers holding the lock */
+        unsigned rw_waitingwriters;     /* writers waiting for it */
+        struct thread *rw_writer;       /* writer holding it, if any */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_acquire_write - Get the lock for writing.
+ *    rwlock_release       - Release the lock, however it was acquired.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                           the lock for writing.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
 
 #endif /* _SYNCH_H_ */
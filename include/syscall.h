@@ -32,6 +32,7 @@
 
 
 struct trapframe; /* from <machine/trapframe.h> */
+struct proc; /* from <proc.h> */
 
 /*
  * The system call dispatcher.
@@ -39,6 +40,13 @@ struct trapframe; /* from <machine/trapframe.h> */
 
 void syscall(struct trapframe *tf);
 
+/*
+ * Per-call counts and times, for the "sc" menu command: print them,
+ * or zero them.
+ */
+void syscall_printstats(void);
+void syscall_resetstats(void);
+
 /*
  * Support functions.
  */
@@ -50,6 +58,18 @@ void enter_forked_process(struct trapframe *tf);
 void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 		       vaddr_t entrypoint);
 
+/* Enter user mode in a new thread of the current process. */
+void enter_new_thread(vaddr_t arg, vaddr_t stackptr, vaddr_t entrypoint);
+
+/* Whether the current process is exiting (a cheap, unlocked peek). */
+bool uthread_exiting(void);
+
+/* On the way back to user mode: exit if the process is exiting. */
+void uthread_checkexit(void);
+
+/* Make the other threads of process P leave; for _exit. */
+void uthread_exitall(struct proc *p);
+
 
 #if OPT_A2
 int sys_open(userptr_t filename, int flags, int mode, int *retval);
@@ -57,6 +77,8 @@ int sys_read(int fdesc, userptr_t ubuf, unsigned int nbytes, int *retval);
 int sys_close(int fdesc, int *retval);
 int sys_fork(struct trapframe *tf, pid_t *retval);
 int sys_execv(userptr_t prog, userptr_t args);
+int sys_spawn(userptr_t path, userptr_t argv, userptr_t actions,
+	      int nactions, pid_t *retval);
 void entrypoint(void *arg1, unsigned long arg2);
 #endif
 
@@ -67,6 +89,14 @@ void entrypoint(void *arg1, unsigned long arg2);
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t req, userptr_t rem);
+int sys_sched_setaffinity(uint32_t mask);
+int sys_sched_getaffinity(userptr_t mask);
+int sys_futex(userptr_t addr, int op, int32_t val, int32_t *retval);
+int sys_thread_create(userptr_t func, userptr_t arg, userptr_t stack,
+		      int32_t *retval);
+void sys_thread_exit(int exitval);
+int sys_thread_join(unsigned tid, userptr_t status);
 
 #ifdef UW
 int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
@@ -51,14 +51,31 @@ int catmouse(int, char **);
 int arraytest(int, char **);
 int bitmaptest(int, char **);
 int queuetest(int, char **);
+int ringbuftest(int, char **);
+int ringbufbench(int, char **);
 
 /* thread tests */
 int threadtest(int, char **);
 int threadtest2(int, char **);
 int threadtest3(int, char **);
+int threadbench(int, char **);
+int forkbench(int, char **);
+int pingpongbench(int, char **);
+int procbench(int, char **);
+int timeouttest(int, char **);
+int spinlockbench(int, char **);
+int atomictest(int, char **);
+int epochtest(int, char **);
+int workqueuetest(int, char **);
+int futextest(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int rwtest(int, char **);
+int cvbroadcastbench(int, char **);
+int fairbench(int, char **);
+int pitest(int, char **);
+int lockspinbench(int, char **);
 
 #ifdef UW
 /* Another thread and synchronization test */
@@ -80,9 +97,11 @@ int malloctest(int, char **);
 int mallocstress(int, char **);
 int nettest(int, char **);
 
-/* Routine for running a user-level program. */
+/* Routines for running a user-level program. */
 #if OPT_A2
 int runprogram(char *progname, int argc, char **argv);
+int runprogram_load(char *progname, int argc, char **argv,
+		    vaddr_t *entrypoint, vaddr_t *stackptr, userptr_t *uargv);
 #else
 int runprogram(char *progname);
 #endif
@@ -64,6 +64,9 @@ typedef enum {
 	S_ZOMBIE,	/* zombie; exited but not yet deleted */
 } threadstate_t;
 
+/* Names shorter than this don't need to be malloc'd. */
+#define THREAD_NAMELEN 16
+
 /* Thread structure. */
 struct thread {
 	/*
@@ -73,6 +76,7 @@ struct thread {
 	char *t_name;			/* Name of this thread */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
 	threadstate_t t_state;		/* State this thread is in */
+	char t_namebuf[THREAD_NAMELEN];	/* Holds t_name if it's short */
 
 	/*
 	 * Thread subsystem internal fields.
@@ -83,6 +87,35 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	unsigned t_tid;			/* User thread id within t_proc */
+	unsigned t_lastrun;		/* t_cpu's c_hardclocks at switch-out */
+	uint32_t t_affinity;		/* Cpus it may run on; see below */
+	unsigned t_quantum;		/* Timeslice length in hardclocks */
+	unsigned t_ticksleft;		/* Hardclocks left in this timeslice */
+	struct thread *t_allnext;	/* Link on the list of all threads */
+	struct thread **t_allprevp;	/* Whatever points to us on it */
+	struct thread *t_wakenext;	/* Link on a cpu's c_wakeq */
+	bool t_handoff;			/* V or lock_release handed off to us */
+	const void *t_sleepkey;		/* Object slept on, if in a sleepq */
+	int t_basepri;			/* Priority set by thread_setpriority */
+	int t_pri;			/* Effective priority; see below */
+	struct lock *t_blockedon;	/* Lock it's asleep waiting for */
+	unsigned t_locksheld;		/* Number of sleep locks held */
+
+	/*
+	 * Scheduler accounting; see thread_printsched(). Times are
+	 * getnsecs() values, or 0 without "options schedstats".
+	 * Updated by the cpu running the thread (or holding its run
+	 * queue lock).
+	 */
+	uint64_t t_readysince;		/* When last made runnable */
+	uint64_t t_oncpusince;		/* When last switched in */
+	uint64_t t_waittime;		/* Total time spent runnable */
+	uint64_t t_runtime;		/* Total time spent running */
+	unsigned t_voluntary;		/* Switches out by sleeping/yielding */
+	unsigned t_involuntary;		/* Switches out by preemption */
+	unsigned t_migrations;		/* Times moved to another cpu */
+	bool t_woken;			/* Made runnable by a wakeup */
 
 	/*
 	 * Interrupt state fields.
@@ -144,6 +177,14 @@ int thread_fork(const char *name, struct proc *proc,
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2);
 
+/*
+ * Like thread_fork, but make a kernel thread (in kproc) whose
+ * affinity is cpu C alone. For per-cpu service threads.
+ */
+int thread_fork_pinned(const char *name, struct cpu *c,
+                       void (*func)(void *, unsigned long),
+                       void *data1, unsigned long data2);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -157,6 +198,84 @@ void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Set the scheduling quantum (the number of hardclocks the current
+ * thread runs before being preempted, if anything else is waiting to
+ * run) of the current thread. Threads it forks afterwards inherit
+ * the setting.
+ */
+void thread_setquantum(unsigned hardclocks);
+
+/*
+ * Print per-cpu scheduling statistics (context switch counts and
+ * rates since the last call) and reset them.
+ */
+void thread_printstats(void);
+
+/*
+ * Print per-thread scheduler accounting (time spent waiting on run
+ * queues and running, voluntary and involuntary switches, and
+ * migrations), most-waiting threads first, followed by a histogram
+ * of wakeup latencies: how long threads woken from sleep waited
+ * before they got to run. thread_resetsched() clears it all. The
+ * times and latencies are only kept with "options schedstats".
+ */
+void thread_printsched(void);
+void thread_resetsched(void);
+
+/*
+ * CPU affinity. A thread only ever runs on the cpus whose bits
+ * (1 << c_number) are set in its affinity mask; the scheduler's
+ * placement, wakeup and load balancing all honour it. Forked threads
+ * inherit the mask of their parent.
+ *
+ * thread_setaffinity sets the current thread's mask, moving it to an
+ * allowed cpu first if it isn't on one. Bits for cpus that don't
+ * exist are dropped; it fails with EINVAL if that leaves none.
+ */
+#define THREAD_AFFINITY_ALL	0xffffffff
+#define THREAD_CPU_ALLOWED(t, c) (((t)->t_affinity & (1U << (c)->c_number)) != 0)
+
+int thread_setaffinity(uint32_t mask);
+uint32_t thread_getaffinity(void);
+
+/*
+ * Thread priorities. Run queues are kept in priority order, highest
+ * first and round-robin within a priority, so a runnable thread never
+ * waits behind one of lower priority. New threads get their parent's
+ * priority.
+ *
+ * t_pri is normally t_basepri, but may be raised by priority
+ * inheritance while the thread holds a lock that a higher-priority
+ * thread is waiting for (see lock_acquire). Both t_pri and
+ * t_blockedon are protected by the priority lock.
+ *
+ * thread_setpriority sets the current thread's base priority;
+ * thread_getpriority returns its effective priority.
+ *
+ * thread_prilock_acquire/release and thread_setpri are for synch.c:
+ * thread_setpri changes T's effective priority, moving it within its
+ * run queue if it's on one, and must be called with the priority
+ * lock held.
+ */
+#define THREAD_PRI_MIN		0
+#define THREAD_PRI_DEFAULT	10
+#define THREAD_PRI_MAX		20
+
+void thread_setpriority(int pri);
+int thread_getpriority(void);
+void thread_prilock_acquire(void);
+void thread_prilock_release(void);
+void thread_setpri(struct thread *t, int pri);
+
+/*
+ * Exited threads are kept (with their stacks) in a per-cpu cache, up
+ * to thread_cache_max per cpu, so thread_fork can reuse them rather
+ * than allocating. Setting it to 0 stops new threads being cached.
+ */
+#define THREAD_CACHE_DEFAULT 8
+extern unsigned thread_cache_max;
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
@@ -168,5 +287,45 @@ void schedule(void);
  */
 void thread_consider_migration(void);
 
+/*
+ * Load balancing policies.
+ *
+ * THREAD_BALANCE_PUSH	busy cpus periodically push surplus threads to
+ *			less busy ones from thread_consider_migration.
+ * THREAD_BALANCE_STEAL	idle cpus steal threads from the busiest run
+ *			queue when they run out of work.
+ *
+ * The policy may be changed at any time; this is mostly useful for
+ * benchmarking one against the other.
+ */
+#define THREAD_BALANCE_PUSH	0
+#define THREAD_BALANCE_STEAL	1
+
+extern int thread_balance_policy;
+
+/*
+ * Wakeup placement policies.
+ *
+ * THREAD_WAKEUP_LAST	a woken thread is queued on the cpu it last ran
+ *			on, whose cache may still hold its working set.
+ * THREAD_WAKEUP_IDLE	likewise if that cpu is idle; but if it's busy
+ *			and another cpu the thread may run on is idle,
+ *			the thread goes there instead, preferring the
+ *			waker's cpu (which is idle when the wakeup comes
+ *			from an interrupt).
+ */
+#define THREAD_WAKEUP_LAST	0
+#define THREAD_WAKEUP_IDLE	1
+
+extern int thread_wakeup_policy;
+
+/*
+ * If true (the default), a thread made runnable on another cpu is
+ * pushed onto that cpu's lock-free wakeup queue, and the cpu is sent
+ * an IPI to move it to its run queue, rather than the waker taking
+ * the other cpu's run queue lock itself.
+ */
+extern bool thread_remote_wakeq;
+
 
 #endif /* _THREAD_H_ */
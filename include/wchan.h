@@ -77,9 +77,51 @@ void wchan_sleep(struct wchan *wc);
  *
  * The current implementation is FIFO but this is not promised by the
  * interface.
+ *
+ * wchan_wakeone returns the thread it woke, or NULL if none was
+ * asleep. The pointer is only good for as long as the woken thread
+ * can't get anywhere, e.g. because the caller holds a spinlock it
+ * must take next; see the hand-off code in synch.c.
  */
-void wchan_wakeone(struct wchan *wc);
+struct thread *wchan_wakeone(struct wchan *wc);
 void wchan_wakeall(struct wchan *wc);
 
 
+/*
+ * Hashed sleep queues.
+ *
+ * These let a thread sleep on any object, named by its address (KEY),
+ * without the object needing a wait channel of its own: threads
+ * sleep on one of a fixed set of shared channels picked by hashing
+ * the key. Locks and CVs use these, so they need no allocations
+ * beyond themselves; futex waiters use them to be woken one by one.
+ *
+ * There are separate tables (SQ_*) so that code holding a queue in
+ * one table can safely lock a queue in another: cv_wait holds the
+ * CV's queue while lock_release wakes the lock's. Lock order is
+ * SQ_CV before SQ_LOCK; never hold two queues in the same table.
+ *
+ * Otherwise these work like the wchan calls above: sleepq_sleep
+ * must be called with the key's queue locked, and unlocks it; the
+ * wakeup calls must be called with it unlocked. NAME is shown as the
+ * thread's wait channel while it sleeps.
+ *
+ * sleepq_requeue moves up to MAX threads sleeping on FROM to sleep on
+ * TO instead, without waking them, and returns the number moved.
+ */
+#define SQ_LOCK		0	/* Sleep queues for locks */
+#define SQ_CV		1	/* Sleep queues for CVs */
+#define SQ_FUTEX	2	/* Sleep queues for futex waiters */
+#define SQ_TABLES	3
+
+void sleepq_bootstrap(void);
+void sleepq_lock(int sq, const void *key);
+void sleepq_unlock(int sq, const void *key);
+void sleepq_sleep(int sq, const void *key, const char *name);
+struct thread *sleepq_wakeone(int sq, const void *key);
+void sleepq_wakeall(int sq, const void *key);
+unsigned sleepq_requeue(int fromsq, const void *from,
+			int tosq, const void *to, unsigned max);
+
+
 #endif /* _WCHAN_H_ */
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Workqueues: deferred work.
+ *
+ * Each cpu has a worker thread (pinned to it) that runs queued work
+ * items in order, in thread context, so they may sleep. Work can be
+ * queued from anywhere, including interrupt handlers; work items are
+ * preallocated, so queueing never allocates memory or sleeps.
+ *
+ * work_queue() arranges for FUNC(ARG) to be called by cpu C's worker.
+ *     If C is null, the current cpu's worker is used. Returns ENOMEM
+ *     if that cpu already has WORKQ_POOLSIZE items outstanding.
+ * work_queue_delayed() is the same, but the work is only queued
+ *     after TICKS hardclocks (see timeout_add).
+ * workqueue_printstats() prints and resets per-cpu statistics:
+ *     items queued and run, queue depth, and latency (time from
+ *     being queued until the worker started on it).
+ */
+
+struct cpu;
+
+#define WORKQ_POOLSIZE 64	/* Outstanding work items per cpu */
+
+void workqueue_bootstrap(void);
+
+int work_queue(struct cpu *c, void (*func)(void *), void *arg);
+int work_queue_delayed(struct cpu *c, void (*func)(void *), void *arg,
+                       unsigned ticks);
+
+void workqueue_printstats(void);
+
+
+#endif /* _WORKQUEUE_H_ */
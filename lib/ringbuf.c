@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Bounded lock-free ring buffer. See ringbuf.h.
+ *
+ * The head and tail indexes run freely and are reduced mod the size
+ * (a power of 2) to index the slots; the ring holds tail - head
+ * items. Everything the other side looks at is volatile, so the
+ * compiler keeps the slot and index accesses in order; System/161
+ * doesn't reorder memory accesses, so no barriers are needed.
+ *
+ * In MPMC mode each slot also has a sequence number saying whose turn
+ * it is: a slot whose sequence number equals position P is free for
+ * the producer that claims P, and one whose number is P + 1 holds the
+ * item for the consumer that claims P. Taking the item out sets it to
+ * P + size, the next position that maps to the slot.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <atomic.h>
+#include <ringbuf.h>
+
+struct ringslot {
+	volatile uint32_t rs_seq;	/* MPMC only */
+	void *volatile rs_ptr;
+};
+
+struct ringbuf {
+	unsigned rb_flags;
+	uint32_t rb_mask;		/* Size - 1 */
+	struct ringslot *rb_slots;
+	volatile uint32_t rb_head;	/* Next to remove */
+	volatile uint32_t rb_tail;	/* Next to add */
+};
+
+struct ringbuf *
+ringbuf_create(unsigned size, unsigned flags)
+{
+	struct ringbuf *rb;
+	unsigned nsize, i;
+
+	KASSERT(size > 0);
+
+	nsize = 1;
+	while (nsize < size) {
+		nsize *= 2;
+		/* prevent infinite loop */
+		KASSERT(nsize > 0);
+	}
+
+	rb = kmalloc(sizeof(struct ringbuf));
+	if (rb == NULL) {
+		return NULL;
+	}
+	rb->rb_slots = kmalloc(nsize * sizeof(struct ringslot));
+	if (rb->rb_slots == NULL) {
+		kfree(rb);
+		return NULL;
+	}
+	for (i=0; i<nsize; i++) {
+		rb->rb_slots[i].rs_seq = i;
+		rb->rb_slots[i].rs_ptr = NULL;
+	}
+	rb->rb_flags = flags;
+	rb->rb_mask = nsize - 1;
+	rb->rb_head = rb->rb_tail = 0;
+	return rb;
+}
+
+void
+ringbuf_destroy(struct ringbuf *rb)
+{
+	KASSERT(rb->rb_head == rb->rb_tail);
+	kfree(rb->rb_slots);
+	kfree(rb);
+}
+
+/*
+ * Single producer, single consumer.
+ */
+
+static
+unsigned
+ringbuf_spsc_putn(struct ringbuf *rb, void *const *ptrs, unsigned n)
+{
+	uint32_t tail, space, i;
+
+	tail = rb->rb_tail;
+	space = rb->rb_mask + 1 - (tail - rb->rb_head);
+	if (n > space) {
+		n = space;
+	}
+	for (i=0; i<n; i++) {
+		rb->rb_slots[(tail + i) & rb->rb_mask].rs_ptr = ptrs[i];
+	}
+	rb->rb_tail = tail + n;
+	return n;
+}
+
+static
+unsigned
+ringbuf_spsc_getn(struct ringbuf *rb, void **ptrs, unsigned n)
+{
+	uint32_t head, avail, i;
+
+	head = rb->rb_head;
+	avail = rb->rb_tail - head;
+	if (n > avail) {
+		n = avail;
+	}
+	for (i=0; i<n; i++) {
+		ptrs[i] = rb->rb_slots[(head + i) & rb->rb_mask].rs_ptr;
+	}
+	rb->rb_head = head + n;
+	return n;
+}
+
+/*
+ * Multiple producers and consumers.
+ *
+ * To claim a batch, count how many slots from the current index on
+ * are ready (free for producers, full for consumers), and then claim
+ * that many by advancing the index with atomic_cas. If someone else
+ * advanced it first, start over. Nobody else can touch a slot that's
+ * ready for us, so the count is still right if the cas succeeds.
+ *
+ * If the first slot isn't ready, its sequence number says why: if
+ * it's behind, the ring is full (or empty); if it's ahead, someone
+ * else claimed it since we read the index.
+ */
+
+static
+unsigned
+ringbuf_mpmc_putn(struct ringbuf *rb, void *const *ptrs, unsigned n)
+{
+	struct ringslot *rs;
+	uint32_t tail, seq = 0, i;
+
+	while (1) {
+		tail = rb->rb_tail;
+		for (i=0; i<n && i<=rb->rb_mask; i++) {
+			rs = &rb->rb_slots[(tail + i) & rb->rb_mask];
+			seq = rs->rs_seq;
+			if (seq != tail + i) {
+				break;
+			}
+		}
+		if (i > 0) {
+			if (atomic_cas(&rb->rb_tail, tail, tail + i)) {
+				break;
+			}
+		}
+		else if (n == 0 || (int32_t)(seq - tail) < 0) {
+			return 0;
+		}
+	}
+
+	n = i;
+	for (i=0; i<n; i++) {
+		rs = &rb->rb_slots[(tail + i) & rb->rb_mask];
+		rs->rs_ptr = ptrs[i];
+		rs->rs_seq = tail + i + 1;
+	}
+	return n;
+}
+
+static
+unsigned
+ringbuf_mpmc_getn(struct ringbuf *rb, void **ptrs, unsigned n)
+{
+	struct ringslot *rs;
+	uint32_t head, seq = 0, i;
+
+	while (1) {
+		head = rb->rb_head;
+		for (i=0; i<n && i<=rb->rb_mask; i++) {
+			rs = &rb->rb_slots[(head + i) & rb->rb_mask];
+			seq = rs->rs_seq;
+			if (seq != head + i + 1) {
+				break;
+			}
+		}
+		if (i > 0) {
+			if (atomic_cas(&rb->rb_head, head, head + i)) {
+				break;
+			}
+		}
+		else if (n == 0 || (int32_t)(seq - (head + 1)) < 0) {
+			return 0;
+		}
+	}
+
+	n = i;
+	for (i=0; i<n; i++) {
+		rs = &rb->rb_slots[(head + i) & rb->rb_mask];
+		ptrs[i] = rs->rs_ptr;
+		rs->rs_seq = head + i + rb->rb_mask + 1;
+	}
+	return n;
+}
+
+/*
+ * Interface.
+ */
+
+unsigned
+ringbuf_putn(struct ringbuf *rb, void *const *ptrs, unsigned n)
+{
+	unsigned ret;
+	int spl = 0;
+
+	if (rb->rb_flags & RINGBUF_INTR) {
+		spl = splhigh();
+	}
+	if (rb->rb_flags & RINGBUF_MPMC) {
+		ret = ringbuf_mpmc_putn(rb, ptrs, n);
+	}
+	else {
+		ret = ringbuf_spsc_putn(rb, ptrs, n);
+	}
+	if (rb->rb_flags & RINGBUF_INTR) {
+		splx(spl);
+	}
+	return ret;
+}
+
+unsigned
+ringbuf_getn(struct ringbuf *rb, void **ptrs, unsigned n)
+{
+	unsigned ret;
+	int spl = 0;
+
+	if (rb->rb_flags & RINGBUF_INTR) {
+		spl = splhigh();
+	}
+	if (rb->rb_flags & RINGBUF_MPMC) {
+		ret = ringbuf_mpmc_getn(rb, ptrs, n);
+	}
+	else {
+		ret = ringbuf_spsc_getn(rb, ptrs, n);
+	}
+	if (rb->rb_flags & RINGBUF_INTR) {
+		splx(spl);
+	}
+	return ret;
+}
+
+int
+ringbuf_put(struct ringbuf *rb, void *ptr)
+{
+	KASSERT(ptr != NULL);
+
+	if (ringbuf_putn(rb, &ptr, 1) == 0) {
+		return ENOSPC;
+	}
+	return 0;
+}
+
+void *
+ringbuf_get(struct ringbuf *rb)
+{
+	void *ptr;
+
+	if (ringbuf_getn(rb, &ptr, 1) == 0) {
+		return NULL;
+	}
+	return ptr;
+}
+
+unsigned
+ringbuf_count(struct ringbuf *rb)
+{
+	uint32_t head, tail;
+
+	/* Head first: then the tail can only have moved further on. */
+	head = rb->rb_head;
+	tail = rb->rb_tail;
+	if (tail - head > rb->rb_mask + 1) {
+		return rb->rb_mask + 1;
+	}
+	return tail - head;
+}
+
+unsigned
+ringbuf_size(struct ringbuf *rb)
+{
+	return rb->rb_mask + 1;
+}
@@ -43,6 +43,8 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <limits.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
@@ -52,6 +54,8 @@
 #include <kern/fcntl.h>
 #include <kern/wait.h>
 #include <array.h>
+#include <atomic.h>
+#include <syscall.h>
 #include "opt-A2.h"  
 
 /*
@@ -73,8 +77,42 @@ struct semaphore *no_proc_sem;
 #endif  // UW
 
 #if OPT_A2
-static struct proctable procs;
-struct lock *proctable_lock;
+/*
+ * The process table: pids map to slots by pid % PROC_SLOTS, so a
+ * lookup is one array access. A slot's pids go up by PROC_SLOTS each
+ * time it's reused, wrapping at PID_MAX, so that a pid doesn't come
+ * back soon after its process goes away. For the same reason the
+ * free slots are handed out in FIFO order.
+ *
+ * PROC_SLOTS should divide PID_MAX+1, so every slot gets the same
+ * number of pids.
+ */
+#define PROC_SLOTS 4096
+
+struct pidslot {
+	struct proc *ps_proc;	/* Process using it, or NULL if free */
+	pid_t ps_pid;		/* Its pid, or if free the next one to use */
+	int ps_next;		/* Next on the free list, or -1 */
+};
+
+static struct pidslot *pidslots;
+static int pidfree_head, pidfree_tail;
+
+/*
+ * Protects the process table, and each process's parent and child
+ * links and is_exit. Lookups by pid only need it for reading.
+ *
+ * An exiting child takes its parent's p_waitlock while holding this,
+ * so never wait for this while holding a p_waitlock. A child is
+ * claimed for reaping by setting p_waited (atomically); only the
+ * claimer may take it off p_zombies and free it.
+ */
+static struct rwlock *procs_lock;
+
+static struct proc *proc_pid_get_locked(pid_t pid);
+static void pid_free(struct proc *proc);
+static void proc_free(struct proc *proc);
+static void kill_orphans(struct proc *thisproc);
 #endif
 
 
@@ -99,6 +137,7 @@ proc_create(const char *name)
 
 	threadarray_init(&proc->p_threads);
 	spinlock_init(&proc->p_lock);
+	proc->p_uthreads = NULL;
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
@@ -111,16 +150,46 @@ proc_create(const char *name)
 #endif // UW
 
 #if OPT_A2
-	proctable_init(&proc->p_children);
+	proc->p_ft = NULL;
+	proc->stdio_reserve = false;
 	proc->exitcode = 0;
 	proc->is_exit = false;
 	proc->pproc = NULL;
-	proc->p_waitpid = lock_create("p_waitpid");
-	proc->p_waitpid_cv = cv_create("p_waitpid_cv");
+	proc->p_children = NULL;
+	proc->p_sibnext = NULL;
+	proc->p_sibpprev = NULL;
+	proc->p_zombies = NULL;
+	proc->p_zombtail = &proc->p_zombies;
+	proc->p_zombnext = NULL;
+	proc->p_zombpprev = NULL;
+	proc->p_waited = 0;
+	proc->p_nunclaimed = 0;
+	proc->p_waitlock = lock_create("p_waitlock");
+	proc->p_waitcv = cv_create("p_waitcv");
 
-	unsigned index;
-	proctable_fill(&procs, proc, &index);
-	proc->pid = index;
+	/*
+	 * kproc is made before there are any threads (so no locking
+	 * is possible, and none is needed).
+	 */
+	struct pidslot *ps;
+	if (kproc != NULL) {
+		rwlock_acquire_write(procs_lock);
+	}
+	if (pidfree_head < 0) {
+		if (kproc != NULL) {
+			rwlock_release(procs_lock);
+		}
+		kfree(proc->p_name);
+		proc_free(proc);
+		return NULL;
+	}
+	ps = &pidslots[pidfree_head];
+	pidfree_head = ps->ps_next;
+	ps->ps_proc = proc;
+	proc->pid = ps->ps_pid;
+	if (kproc != NULL) {
+		rwlock_release(procs_lock);
+	}
 
 	return proc;
 #else
@@ -159,6 +228,12 @@ proc_destroy(struct proc *proc)
 		VOP_DECREF(proc->p_cwd);
 		proc->p_cwd = NULL;
 	}
+#if OPT_A2
+	if (proc->p_ft) {
+		destroy_filetable(proc->p_ft);
+		proc->p_ft = NULL;
+	}
+#endif
 
 
 #ifndef UW  // in the UW version, space destruction occurs in sys_exit, not here
@@ -187,23 +262,51 @@ proc_destroy(struct proc *proc)
 	}
 #endif // UW
 
+	if (proc->p_uthreads) {
+		struct uthreadset *us = proc->p_uthreads;
+		struct uthread *ut;
+
+		/* Only the thread that called _exit is left. */
+		KASSERT(us->us_live <= 1);
+		while (us->us_threads != NULL) {
+			ut = us->us_threads;
+			us->us_threads = ut->ut_next;
+			kfree(ut);
+		}
+		cv_destroy(us->us_cv);
+		lock_destroy(us->us_lock);
+		kfree(us);
+		proc->p_uthreads = NULL;
+	}
+
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
 
 	kfree(proc->p_name);
+	proc->p_name = NULL;
 
 #if OPT_A2
+	rwlock_acquire_write(procs_lock);
 	kill_orphans(proc);
-
-	struct proc *parent = proc->pproc;
-	if(parent == NULL){
-		lock_destroy(proc->p_waitpid);
-		cv_destroy(proc->p_waitpid_cv);
-
-		proctable_set(&procs, proc->pid, NULL);
+	if (proc->pproc == NULL) {
+		pid_free(proc);
+		rwlock_release(procs_lock);
+		proc_free(proc);
+	}
+	else {
+		/* Stay as a zombie until the parent waits for us. */
+		struct proc *parent = proc->pproc;
+
+		lock_acquire(parent->p_waitlock);
+		proc->is_exit = true;
+		proc->p_zombnext = NULL;
+		proc->p_zombpprev = parent->p_zombtail;
+		*parent->p_zombtail = proc;
+		parent->p_zombtail = &proc->p_zombnext;
+		cv_broadcast(parent->p_waitcv, parent->p_waitlock);
+		lock_release(parent->p_waitlock);
+		rwlock_release(procs_lock);
 	}
-
-	kfree(proc);
 #else
 	kfree(proc);
 #endif
@@ -233,7 +336,26 @@ void
 proc_bootstrap(void)
 {
 #if OPT_A2
-	proctable_init(&procs);
+	int i;
+
+	pidslots = kmalloc(PROC_SLOTS * sizeof(struct pidslot));
+	if (pidslots == NULL) {
+		panic("could not create process table\n");
+	}
+	/* Free list in pid order, so the low slots' first pids come last. */
+	pidfree_head = PID_MIN;
+	for (i=0; i<PROC_SLOTS; i++) {
+		pidslots[i].ps_proc = NULL;
+		pidslots[i].ps_pid = i < PID_MIN ? i + PROC_SLOTS : i;
+		pidslots[i].ps_next = (i + 1) % PROC_SLOTS;
+	}
+	pidfree_tail = PID_MIN - 1;
+	pidslots[pidfree_tail].ps_next = -1;
+
+	procs_lock = rwlock_create("procs");
+	if (procs_lock == NULL) {
+		panic("could not create procs lock\n");
+	}
 #endif
 
   kproc = proc_create("[kernel]");
@@ -270,11 +392,6 @@ proc_create_runprogram(const char *name)
 		return NULL;
 	}
 
-#if OPT_A2
-	int success = proctable_add(&procs, proc, NULL);
-	kprintf("%d", success);
-#endif
-
 #ifdef UW
 	/* open the console - this should always succeed */
 	console_path = kstrdup("con:");
@@ -414,39 +531,281 @@ curproc_setas(struct addrspace *newas)
 }
 
 #if OPT_A2
+/*
+ * Free the slot of a process that's going away. Call with procs_lock
+ * held for writing.
+ */
+static
+void
+pid_free(struct proc *proc)
+{
+	struct pidslot *ps;
+	int slot;
+
+	slot = proc->pid % PROC_SLOTS;
+	ps = &pidslots[slot];
+	KASSERT(ps->ps_proc == proc);
+
+	ps->ps_proc = NULL;
+	ps->ps_pid += PROC_SLOTS;
+	if (ps->ps_pid > PID_MAX) {
+		ps->ps_pid = slot < PID_MIN ? slot + PROC_SLOTS : slot;
+	}
+	ps->ps_next = -1;
+	if (pidfree_head < 0) {
+		pidfree_head = slot;
+	}
+	else {
+		pidslots[pidfree_tail].ps_next = slot;
+	}
+	pidfree_tail = slot;
+}
+
+/*
+ * Free what's left of a process once it's out of the table.
+ */
+static
+void
+proc_free(struct proc *proc)
+{
+	KASSERT(proc->p_children == NULL);
+
+	if (proc->p_waitlock != NULL) {
+		lock_destroy(proc->p_waitlock);
+	}
+	if (proc->p_waitcv != NULL) {
+		cv_destroy(proc->p_waitcv);
+	}
+	kfree(proc);
+}
+
+/*
+ * Take an exited process off its parent's queue of zombies. Call with
+ * the parent's p_waitlock held.
+ */
+static
 void
-kill_orphans(struct proc *thisproc){
-	spinlock_acquire(&thisproc->p_lock);
-		unsigned i=0;
-		for(;i<proctable_num(&thisproc->p_children); i++){
-			struct proc *pd = proctable_get(&thisproc->p_children, i);
-			pd->pproc = NULL;
+proc_unzombie(struct proc *child)
+{
+	struct proc *parent = child->pproc;
+
+	KASSERT(lock_do_i_hold(parent->p_waitlock));
+	KASSERT(child->p_zombpprev != NULL);
+
+	*child->p_zombpprev = child->p_zombnext;
+	if (child->p_zombnext != NULL) {
+		child->p_zombnext->p_zombpprev = child->p_zombpprev;
+	}
+	else {
+		parent->p_zombtail = child->p_zombpprev;
+	}
+	child->p_zombnext = NULL;
+	child->p_zombpprev = NULL;
+}
+
+/*
+ * Take a process off its parent's list of children.
+ */
+static
+void
+proc_unlink(struct proc *child)
+{
+	KASSERT(child->pproc != NULL);
+
+	*child->p_sibpprev = child->p_sibnext;
+	if (child->p_sibnext != NULL) {
+		child->p_sibnext->p_sibpprev = child->p_sibpprev;
+	}
+	child->p_sibnext = NULL;
+	child->p_sibpprev = NULL;
+	child->pproc = NULL;
+}
+
+void
+proc_addchild(struct proc *parent, struct proc *child)
+{
+	KASSERT(child->pproc == NULL);
+
+	rwlock_acquire_write(procs_lock);
+	child->pproc = parent;
+	child->p_sibnext = parent->p_children;
+	if (child->p_sibnext != NULL) {
+		child->p_sibnext->p_sibpprev = &child->p_sibnext;
+	}
+	child->p_sibpprev = &parent->p_children;
+	parent->p_children = child;
+	lock_acquire(parent->p_waitlock);
+	parent->p_nunclaimed++;
+	lock_release(parent->p_waitlock);
+	rwlock_release(procs_lock);
+}
+
+/*
+ * Orphan the children of a process that's going away; any that have
+ * already exited won't be waited for now, so free them. Call with
+ * procs_lock held for writing.
+ */
+static
+void
+kill_orphans(struct proc *thisproc)
+{
+	struct proc *child;
+
+	while ((child = thisproc->p_children) != NULL) {
+		proc_unlink(child);
+		if (child->is_exit) {
+			pid_free(child);
+			proc_free(child);
 		}
-	spinlock_release(&thisproc->p_lock);
-	return;
+	}
+	/* Nobody can be waiting any more; those were all freed above. */
+	thisproc->p_zombies = NULL;
+	thisproc->p_zombtail = &thisproc->p_zombies;
+	thisproc->p_nunclaimed = 0;
+}
+
+int
+proc_wait(struct proc *parent, pid_t pid, int options,
+	  pid_t *pidret, int *status)
+{
+	struct proc *child;
+	bool claimed;
+
+	child = NULL;
+	if (pid != -1) {
+		/*
+		 * Claim it before letting go of procs_lock; once it's
+		 * claimed only we can free it.
+		 */
+		rwlock_acquire_read(procs_lock);
+		child = proc_pid_get_locked(pid);
+		claimed = child != NULL && child->pproc == parent &&
+			atomic_cas(&child->p_waited, 0, 1);
+		rwlock_release(procs_lock);
+		if (!claimed) {
+			return ECHILD;
+		}
+	}
+
+	lock_acquire(parent->p_waitlock);
+	if (child != NULL) {
+		/* Wait-any sleepers may be waiting on just this one. */
+		KASSERT(parent->p_nunclaimed > 0);
+		parent->p_nunclaimed--;
+		if (parent->p_nunclaimed == 0) {
+			cv_broadcast(parent->p_waitcv, parent->p_waitlock);
+		}
+		while (!child->is_exit) {
+			if (options & WNOHANG) {
+				atomic_store(&child->p_waited, 0);
+				parent->p_nunclaimed++;
+				lock_release(parent->p_waitlock);
+				*pidret = 0;
+				return 0;
+			}
+			if (uthread_exiting()) {
+				/* _exit in another thread; see below. */
+				atomic_store(&child->p_waited, 0);
+				parent->p_nunclaimed++;
+				lock_release(parent->p_waitlock);
+				return EINTR;
+			}
+			cv_wait(parent->p_waitcv, parent->p_waitlock);
+		}
+	}
+	else {
+		/*
+		 * Take the oldest zombie nobody else has claimed. Other
+		 * threads of ours may claim children meanwhile, so check
+		 * each time around whether any are left to wait for.
+		 */
+		while (1) {
+			for (child = parent->p_zombies; child != NULL;
+			     child = child->p_zombnext) {
+				if (atomic_cas(&child->p_waited, 0, 1)) {
+					break;
+				}
+			}
+			if (child != NULL) {
+				parent->p_nunclaimed--;
+				break;
+			}
+			if (parent->p_nunclaimed == 0) {
+				lock_release(parent->p_waitlock);
+				return ECHILD;
+			}
+			if (options & WNOHANG) {
+				lock_release(parent->p_waitlock);
+				*pidret = 0;
+				return 0;
+			}
+			if (uthread_exiting()) {
+				/*
+				 * Another thread of ours is in _exit and
+				 * waiting for us to leave; it broadcasts
+				 * p_waitcv after setting us_exiting.
+				 */
+				lock_release(parent->p_waitlock);
+				return EINTR;
+			}
+			cv_wait(parent->p_waitcv, parent->p_waitlock);
+		}
+	}
+	proc_unzombie(child);
+	lock_release(parent->p_waitlock);
+	*pidret = child->pid;
+	*status = child->exitcode;
+
+	/* Wait for proc_destroy to let go of procs_lock too. */
+	rwlock_acquire_write(procs_lock);
+	proc_unlink(child);
+	pid_free(child);
+	rwlock_release(procs_lock);
+	proc_free(child);
+	return 0;
 }
 
 bool
 is_proc_child(struct proc *thisproc, pid_t child_pid){
-	struct proc *child_process = proc_pid_get(child_pid);
-	if(child_process->pproc == thisproc){
-		return true;
+	struct proc *child_process;
+	bool ret;
+
+	rwlock_acquire_read(procs_lock);
+	child_process = proc_pid_get_locked(child_pid);
+	ret = child_process != NULL && child_process->pproc == thisproc;
+	rwlock_release(procs_lock);
+	return ret;
+}
+
+/*
+ * Look up a pid, with procs_lock held.
+ */
+static
+struct proc *
+proc_pid_get_locked(pid_t pid)
+{
+	struct pidslot *ps;
+
+	if (pid < PID_MIN || pid > PID_MAX) {
+		return NULL;
 	}
-	else
-		return false;
+	ps = &pidslots[pid % PROC_SLOTS];
+	if (ps->ps_proc == NULL || ps->ps_pid != pid) {
+		return NULL;
+	}
+	return ps->ps_proc;
 }
 
+/*
+ * Returns NULL if there's no such process.
+ */
 struct proc *
 proc_pid_get(pid_t pid){
-	unsigned i = 0;
-	struct proc *pd = NULL;
-	for(; i<proctable_num(&procs); i++)
-	{
-		pd = proctable_get(&procs, i);
-		if(pd->pid == pid){
-			break;
-		}
-	}
-	return pd;
+	struct proc *found;
+
+	rwlock_acquire_read(procs_lock);
+	found = proc_pid_get_locked(pid);
+	rwlock_release(procs_lock);
+	return found;
 }
 #endif
@@ -39,6 +39,8 @@
 #include <spl.h>
 #include <clock.h>
 #include <thread.h>
+#include <workqueue.h>
+#include <futex.h>
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
@@ -110,6 +112,7 @@ boot(void)
 	proc_bootstrap();
 	thread_bootstrap();
 	hardclock_bootstrap();
+	futex_bootstrap();
 	vfs_bootstrap();
 
 	/* Probe and initialize devices. Interrupts should come on. */
@@ -125,6 +128,7 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
+	workqueue_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
@@ -36,6 +36,9 @@
 #include <uio.h>
 #include <clock.h>
 #include <thread.h>
+#include <workqueue.h>
+#include <lockstat.h>
+#include <current.h>
 #include <proc.h>
 #include <synch.h>
 #include <vfs.h>
@@ -421,6 +424,161 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_schedstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for printing (or clearing) per-thread scheduler accounting.
+ */
+static
+int
+cmd_threadstats(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		thread_resetsched();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: ts [reset]\n");
+		return EINVAL;
+	}
+
+	thread_printsched();
+
+	return 0;
+}
+
+/*
+ * Command for printing (or clearing) per-syscall counts and times.
+ */
+static
+int
+cmd_syscallstats(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		syscall_resetstats();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: sc [reset]\n");
+		return EINVAL;
+	}
+
+	syscall_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_workstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	workqueue_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for setting the scheduling quantum. Programs and tests
+ * started from the menu afterwards inherit it.
+ */
+static
+int
+cmd_quantum(int nargs, char **args)
+{
+	int quantum;
+
+	if (nargs == 1) {
+		kprintf("Quantum is %u hardclocks\n", curthread->t_quantum);
+		return 0;
+	}
+	if (nargs != 2) {
+		kprintf("Usage: quantum [hardclocks]\n");
+		return EINVAL;
+	}
+
+	quantum = atoi(args[1]);
+	if (quantum <= 0) {
+		kprintf("Quantum must be positive\n");
+		return EINVAL;
+	}
+	thread_setquantum(quantum);
+
+	return 0;
+}
+
+/*
+ * Command for setting how long lock_acquire spins for a running
+ * holder before sleeping. 0 turns spinning off.
+ */
+static
+int
+cmd_lockspin(int nargs, char **args)
+{
+	int budget;
+
+	if (nargs == 1) {
+		kprintf("Lock spin budget is %u\n", lock_spin_budget);
+		return 0;
+	}
+	if (nargs != 2) {
+		kprintf("Usage: lockspin [polls]\n");
+		return EINVAL;
+	}
+
+	budget = atoi(args[1]);
+	if (budget < 0) {
+		kprintf("Spin budget can't be negative\n");
+		return EINVAL;
+	}
+	lock_spin_budget = budget;
+
+	return 0;
+}
+
+#if OPT_LOCKSTAT
+/*
+ * Command for printing (or clearing) the lock contention profile.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	int topn = 10;
+
+	if (nargs > 2) {
+		kprintf("Usage: lockstat [count | reset]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		if (!strcmp(args[1], "reset")) {
+			lockstat_reset();
+			return 0;
+		}
+		topn = atoi(args[1]);
+		if (topn <= 0) {
+			kprintf("Count must be positive\n");
+			return EINVAL;
+		}
+	}
+	lockstat_print(topn);
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -460,6 +618,11 @@ static const char *opsmenu[] = {
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+	"[quantum] Set scheduling quantum    ",
+	"[lockspin] Set lock spin budget     ",
+#if OPT_LOCKSTAT
+	"[lockstat] Lock contention profile  ",
+#endif
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
 	"[dth]     Enable DB_THREADS messages",
@@ -480,17 +643,36 @@ cmd_opsmenu(int n, char **a)
 static const char *testmenu[] = {
 	"[at]  Array test                    ",
 	"[bt]  Bitmap test                   ",
+	"[rb1] Ring buffer test              ",
+	"[rb2] Ring buffer bench             ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[tt4] Scheduler throughput bench    ",
+	"[tt5] Thread create/exit bench      ",
+	"[tt6] Cross-cpu wakeup bench        ",
+#if OPT_A2
+	"[pt1] Process table bench           ",
+#endif
+	"[tmo] Timeout test                  ",
+	"[sp1] Spinlock contention bench     ",
+	"[at1] Atomic/per-cpu test           ",
+	"[ep1] Epoch reclamation test        ",
+	"[wq1] Workqueue test                ",
+	"[fx1] Futex lock bench              ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] RW lock test                  ",
+	"[sy5] CV broadcast bench            ",
+	"[sy6] Lock fairness bench           ",
+	"[sy7] Priority inversion test       ",
+	"[sy8] Lock spin bench               ",
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -530,6 +712,10 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+	"[cs] Context switch stats           ",
+	"[ts] Thread scheduling stats        ",
+	"[wq] Workqueue stats                ",
+	"[sc] System call stats              ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -570,6 +756,11 @@ static struct {
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+	{ "quantum",	cmd_quantum },
+	{ "lockspin",	cmd_lockspin },
+#if OPT_LOCKSTAT
+	{ "lockstat",	cmd_lockstat },
+#endif
 	{ "panic",	cmd_panic },
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
@@ -586,10 +777,16 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "cs",		cmd_schedstats },
+	{ "ts",		cmd_threadstats },
+	{ "wq",		cmd_workstats },
+	{ "sc",		cmd_syscallstats },
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "bt",		bitmaptest },
+	{ "rb1",	ringbuftest },
+	{ "rb2",	ringbufbench },
 	{ "km1",	malloctest },
 	{ "km2",	mallocstress },
 #if OPT_NET
@@ -598,11 +795,28 @@ static struct {
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "tt4",	threadbench },
+	{ "tt5",	forkbench },
+	{ "tt6",	pingpongbench },
+#if OPT_A2
+	{ "pt1",	procbench },
+#endif
+	{ "tmo",	timeouttest },
+	{ "sp1",	spinlockbench },
+	{ "at1",	atomictest },
+	{ "ep1",	epochtest },
+	{ "wq1",	workqueuetest },
+	{ "fx1",	futextest },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	rwtest },
+	{ "sy5",	cvbroadcastbench },
+	{ "sy6",	fairbench },
+	{ "sy7",	pitest },
+	{ "sy8",	lockspinbench },
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 	{ "uw2",	uwvmstatstest },
@@ -145,12 +145,14 @@ sys_read(int fdesc, userptr_t ubuf, unsigned int nbytes, int *retval){
         }
     }
     
-    tempfile = curproc->p_ft->files[fdesc];
+    /* pinned, so a close in another thread can't free it under us */
+    tempfile = get_file(curproc->p_ft, fdesc);
     if(tempfile == NULL){
         *retval = EBADF;
         return -1;
     }
     if(tempfile->flags == O_WRONLY){
+        release_file(tempfile);
         *retval = EBADF;
         return -1;
     }
@@ -161,6 +163,7 @@ sys_read(int fdesc, userptr_t ubuf, unsigned int nbytes, int *retval){
     tempfile->offset = u.uio_offset;
     *retval = data;
     lock_release(tempfile->rw_lock);
+    release_file(tempfile);
     return 0;
 
 }
@@ -222,12 +225,14 @@ sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
     
     
     
-    tempfile = curthread->t_proc->p_ft->files[fdesc];
+    /* pinned, so a close in another thread can't free it under us */
+    tempfile = get_file(curthread->t_proc->p_ft, fdesc);
     if(tempfile == NULL){
         *retval = EBADF;
         return -1;
     }
     if(tempfile->flags == O_RDONLY){
+        release_file(tempfile);
         *retval = EBADF;
         return -1;
     }
@@ -239,6 +244,8 @@ sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
     if(fdesc > 0){
         err = VOP_WRITE(tempfile->vn,&u);
         if(err){
+            lock_release(tempfile->rw_lock);
+            release_file(tempfile);
             *retval = err;
             return -1;
         }
@@ -248,6 +255,7 @@ sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
     *retval = data;
     
     lock_release(tempfile->rw_lock);
+    release_file(tempfile);
   return 0;
 
   #else
@@ -8,6 +8,7 @@
 #include <kern/fcntl.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <atomic.h>
 
 #if OPT_A2
 
@@ -25,6 +26,15 @@ struct FileTable* create_filetable(void) {
 	    kfree(ft);
         return NULL;
     }
+    ft->ft_lock = lock_create("ft_lock");
+    if (ft->ft_lock == NULL) {
+        bitmap_destroy(ft->bm);
+        kfree(ft);
+        return NULL;
+    }
+    for (int i = 0; i < OPEN_MAX; i++) {
+        ft->files[i] = NULL;
+    }
 
     return ft;
 }
@@ -38,40 +48,45 @@ struct FileTable* create_filetable(void) {
 
 int duplicate_filetable(struct FileTable *src, struct FileTable *dest) {
 	KASSERT(dest != NULL);
-	dest->num_files = src->num_files;
 	dest->bm = bitmap_create(OPEN_MAX);
 	if (dest->bm == NULL) {
 		kfree(dest);
 		return -1;
 	}
+	dest->ft_lock = lock_create("ft_lock");
+	if (dest->ft_lock == NULL) {
+		bitmap_destroy(dest->bm);
+		kfree(dest);
+		return -1;
+	}
 	
+	lock_acquire(src->ft_lock);
+	dest->num_files = src->num_files;
 	for(int i = 0; i < OPEN_MAX; i++) {
 		if(bitmap_isset(src->bm, i)) {
 			bitmap_mark(dest->bm, i);
 			dest->files[i] = src->files[i];
-            VOP_INCOPEN(dest->files[i]->vn);//increase the num of open file
+            atomic_inc(&dest->files[i]->refcount);//shared, closed when the last table closes it
 		} else {
 			dest->files[i] = NULL;
 		}
 	}
+	lock_release(src->ft_lock);
 	
 	return 0;
 }
 
 int destroy_filetable(struct FileTable *ft) {
-	//check if there is any other files open besides stdin/out/err
-    //KASSERT(ft->num_files == 3);
-    
-    //remove stdin/out/err from file table
-    for (int i = 0; i < 3; i ++) {
+    //close whatever is still open, then free the table
+    for (int i = 0; i < OPEN_MAX; i ++) {
         if(bitmap_isset(ft->bm, i)) {
-            ft->files[i] = NULL;
-            ft->num_files --;
-            bitmap_unmark(ft->bm, i);	
+            close_file_and_remove_from_table(ft, i);
 		}
     }
-	
-    ft = NULL;
+    KASSERT(ft->num_files == 0);
+    bitmap_destroy(ft->bm);
+    lock_destroy(ft->ft_lock);
+    kfree(ft);
 
 	return 0;
 }
@@ -85,54 +100,95 @@ int create_file_and_add_to_table(struct FileTable *ft, struct vnode *vn, int fla
     f->vn = vn;
     f->flags = flags;
     f->offset = 0;
+    f->refcount = 1;
     f->rw_lock = lock_create("rw_lock");
     if(f->rw_lock == NULL){
         kfree(f);
         return -1;
     }
+    lock_acquire(ft->ft_lock);
     for (int i = 0; i < OPEN_MAX; i++) {
         if (!bitmap_isset(ft->bm, i)) {
-            f->fd = i;
+            f->fdesc = i;
             bitmap_mark(ft->bm, i);
             ft->files[i] = f;
             ft->num_files ++;
+            lock_release(ft->ft_lock);
             *fd = i;
             return 0;
         }
     }
+    lock_release(ft->ft_lock);
     
+    lock_destroy(f->rw_lock);
+    kfree(f);
     return EMFILE;  /* process's file table is full */
 }
 
 int file_exists_in_table(struct FileTable *ft, unsigned int fd) {
     
+	int ret;
+
 	if(fd >= OPEN_MAX) {
 		return EBADF; /* invalid file handle */
 	}
 	
-	return bitmap_isset(ft->bm, fd);
+	lock_acquire(ft->ft_lock);
+	ret = bitmap_isset(ft->bm, fd);
+	lock_release(ft->ft_lock);
+	return ret;
 }
 
 
 /* the fd is a valid file handle */
 int close_file_and_remove_from_table(struct FileTable *ft, unsigned int fd) {	
-    if (!bitmap_isset(ft->bm, fd)) {
+    lock_acquire(ft->ft_lock);
+    if (fd >= OPEN_MAX || !bitmap_isset(ft->bm, fd)) {
+        lock_release(ft->ft_lock);
         return -1; /* the file is not open */
     }
     struct File *f = ft->files[fd];
-    vfs_close(f->vn); /* close vnode; wouldn't fail */
-    f->vn = NULL;
-    lock_destroy(f->rw_lock);
-    kfree(f);
-    
     bitmap_unmark(ft->bm, fd);
 	ft->files[fd] = NULL;
 	ft->num_files --;
+    lock_release(ft->ft_lock);
+
+    /* I/O still going on in other threads keeps it open until done */
+    release_file(f);
 	
 	return 0;
 }
 
 
+/*
+ * put src's open file srcfd in dest as destfd, sharing it (and its
+ * offset), as for spawn. destfd must be free.
+ */
+int share_file_with_table(struct FileTable *src, unsigned int srcfd, struct FileTable *dest, unsigned int destfd) {
+    if (destfd >= OPEN_MAX) {
+        return EBADF;
+    }
+    struct File *f = get_file(src, srcfd);
+    if (f == NULL) {
+        return EBADF;
+    }
+
+    lock_acquire(dest->ft_lock);
+    if (bitmap_isset(dest->bm, destfd)) {
+        lock_release(dest->ft_lock);
+        release_file(f);
+        return EBADF;
+    }
+    /* dest keeps the reference get_file took */
+    bitmap_mark(dest->bm, destfd);
+    dest->files[destfd] = f;
+    dest->num_files ++;
+    lock_release(dest->ft_lock);
+
+    return 0;
+}
+
+
 //operations for File
 
 int get_file_by_id(struct FileTable *ft, unsigned int fd, struct File *ret) {
@@ -146,4 +202,38 @@ int get_file_by_id(struct FileTable *ft, unsigned int fd, struct File *ret) {
         return 0;
 }
 
+/*
+ * Look up fd and pin the File so it stays open while it's used, even
+ * if another thread closes fd. Returns NULL if fd isn't open. Call
+ * release_file when done.
+ */
+struct File *get_file(struct FileTable *ft, unsigned int fd) {
+    struct File *f = NULL;
+
+    if (fd >= OPEN_MAX) {
+        return NULL;
+    }
+    lock_acquire(ft->ft_lock);
+    if (bitmap_isset(ft->bm, fd)) {
+        f = ft->files[fd];
+        atomic_inc(&f->refcount);
+    }
+    lock_release(ft->ft_lock);
+    return f;
+}
+
+/*
+ * Drop a reference to f from get_file or a table slot; the last one
+ * closes it.
+ */
+void release_file(struct File *f) {
+    KASSERT(f->refcount > 0);
+    if (atomic_dec(&f->refcount) == 0) {
+        vfs_close(f->vn); /* close vnode; wouldn't fail */
+        f->vn = NULL;
+        lock_destroy(f->rw_lock);
+        kfree(f);
+    }
+}
+
 #endif
\ No newline at end of file
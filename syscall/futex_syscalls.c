@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/futex.h>
+#include <lib.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <futex.h>
+#include <syscall.h>
+
+/*
+ * The futex system call. See <kern/futex.h>.
+ *
+ * The user address is translated to a physical address here, which
+ * futex_wait then reads directly, so an unmapped address is caught
+ * as EFAULT up front rather than faulting later.
+ */
+int
+sys_futex(userptr_t user_addr, int op, int32_t val, int32_t *retval)
+{
+	struct addrspace *as;
+	vaddr_t vaddr;
+	paddr_t paddr;
+	int result;
+
+	vaddr = (vaddr_t)user_addr;
+	if (vaddr % sizeof(int32_t) != 0) {
+		return EINVAL;
+	}
+	if (vaddr >= USERSPACETOP) {
+		return EFAULT;
+	}
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+	result = as_translate(as, vaddr, &paddr);
+	if (result) {
+		return result;
+	}
+
+	switch (op) {
+	    case FUTEX_WAIT:
+		return futex_wait(paddr, val);
+	    case FUTEX_WAKE:
+		if (val < 0) {
+			return EINVAL;
+		}
+		*retval = futex_wake(paddr, val);
+		return 0;
+	}
+	return EINVAL;
+}
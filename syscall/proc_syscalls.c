@@ -82,6 +82,9 @@ void sys__exit(int exitcode) {
 
   DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
 
+  /* wait for any other threads in the process to leave first */
+  uthread_exitall(p);
+
   KASSERT(curproc->p_addrspace != NULL);
   as_deactivate();
   /*
@@ -100,15 +103,12 @@ void sys__exit(int exitcode) {
 
   #if OPT_A2
   p->exitcode = _MKWAIT_EXIT(exitcode);
-  p->is_exit = true;
-
-  lock_acquire(p->p_waitpid);
-  cv_broadcast(p->p_waitpid_cv, p->p_waitpid);
-  lock_release(p->p_waitpid);
   #endif
 
   /* if this is the last user process in the system, proc_destroy()
      will wake up the kernel menu thread */
+  /* if the parent is still around this leaves p as a zombie for
+     proc_wait to collect */
   proc_destroy(p);
   
   thread_exit();
@@ -143,43 +143,33 @@ sys_waitpid(pid_t pid,
   int exitstatus;
   int result;
 
-  /* this is just a stub implementation that always reports an
-     exit status of 0, regardless of the actual exit status of
-     the specified process.   
-     In fact, this will return 0 even if the specified process
-     is still running, and even if it never existed in the first place.
-
-     Fix this!
-  */
-
-  if (options != 0) {
+  if (options != 0 && options != WNOHANG) {
     return(EINVAL);
   }
 
   #if OPT_A2
-  struct proc *thisproc = curproc;
-  bool mychild = is_proc_child(thisproc, pid);
-  if(!mychild){
-    kprintf("Error not child of current process");
-    return 0;
+  /* pid -1 means any child; process groups aren't supported */
+  if (pid == 0 || pid < -1) {
+    return(EINVAL);
   }
-
-  struct proc *waitingproc = proc_pid_get(pid);
-  lock_acquire(waitingproc->p_waitpid);
-  while(waitingproc->is_exit == false){
-    cv_wait(waitingproc->p_waitpid_cv, waitingproc->p_waitpid);
+  result = proc_wait(curproc, pid, options, &pid, &exitstatus);
+  if (result) {
+    return result;
+  }
+  if (pid == 0) {
+    /* WNOHANG, and nothing has exited yet */
+    *retval = 0;
+    return(0);
   }
-  lock_release(waitingproc->p_waitpid);
-  
-  exitstatus = waitingproc->exitcode;
-
   #else
   exitstatus = 0;
   #endif
 
-  result = copyout((void *)&exitstatus,status,sizeof(int));
-  if (result) {
-    return(result);
+  if (status != NULL) {
+    result = copyout((void *)&exitstatus,status,sizeof(int));
+    if (result) {
+      return(result);
+    }
   }
   *retval = pid;
   return(0);
@@ -47,15 +47,18 @@
 #include <copyinout.h>
 #include "opt-A2.h"
 
+#if OPT_A2
 /*
- * Load program "progname" and start running it in usermode.
- * Does not return except on error.
+ * Load program "progname" into a new address space for the current
+ * process, and copy its arguments onto the user stack. Hands back
+ * what enter_new_process needs. Used by runprogram and spawn.
  *
  * Calls vfs_open on progname and thus may destroy it.
  */
-#if OPT_A2
 int
-runprogram(char *progname, int argc, char **argv)
+runprogram_load(char *progname, int argc, char **argv,
+		vaddr_t *entrypointret, vaddr_t *stackptrret,
+		userptr_t *argvret)
 {
 	struct addrspace *as;
 	struct vnode *v;
@@ -158,8 +161,34 @@ runprogram(char *progname, int argc, char **argv)
 	kfree(argLengths);
 	kfree(argBuff);
 
+	*entrypointret = entrypoint;
+	*stackptrret = userStackPtr;
+	*argvret = (userptr_t)userStackPtr;//userStackPtr currently is argv pointer
+	return 0;
+}
+
+/*
+ * Load program "progname" and start running it in usermode.
+ * Does not return except on error.
+ *
+ * Calls vfs_open on progname and thus may destroy it.
+ */
+int
+runprogram(char *progname, int argc, char **argv)
+{
+	vaddr_t entrypoint, stackptr;
+	userptr_t uargv;
+	int result;
+
+	result = runprogram_load(progname, argc, argv, &entrypoint,
+				 &stackptr, &uargv);
+	if (result) {
+		return result;
+	}
+
 	/* Warp to user mode. */
-	enter_new_process(argc/*argc*/, (userptr_t)userStackPtr/*userspace addr of argv*/, userStackPtr, entrypoint);//userStackPtr currently is argv pointer
+	enter_new_process(argc/*argc*/, uargv/*userspace addr of argv*/,
+			  stackptr, entrypoint);
 	
 	/* enter_new_process does not return. */
 	panic("enter_new_process returned\n");
@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * spawn: start a program in a new child process.
+ *
+ * This is what fork followed by execv would do, but without copying
+ * the parent's address space only to throw it away: the child gets a
+ * fresh address space loaded straight from the executable, so the
+ * cost doesn't depend on the size of the parent. The child's file
+ * table holds only the descriptors the caller asks for (see
+ * <kern/spawn.h>).
+ *
+ * The program is loaded by the child's own thread, since it loads
+ * into the current process's address space; the parent waits until
+ * that's done, so load errors (no such file, bad executable, ...)
+ * come back from spawn itself rather than as the child's exit status.
+ * The child joins its parent's children only once the load has
+ * worked, so nobody can wait for (and reap) a child whose spawn
+ * failed.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/spawn.h>
+#include <limits.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <filetable.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include <test.h>
+#include "opt-A2.h"
+
+#if OPT_A2
+
+/*
+ * Handed from the parent to the child's first thread.
+ */
+struct spawnargs {
+	struct proc *sa_parent;		/* Who's spawning us */
+	char *sa_path;			/* Program to load */
+	int sa_argc;			/* Its arguments */
+	char **sa_argv;
+	struct semaphore *sa_loaded;	/* V'd when the load is done */
+	int sa_result;			/* ...and how it went */
+};
+
+static
+void
+spawn_freeargs(int argc, char **argv)
+{
+	int i;
+
+	for (i=0; i<argc; i++) {
+		kfree(argv[i]);
+	}
+	kfree(argv);
+}
+
+/*
+ * Copy in a user argv. Each string must fit in PATH_MAX bytes, and
+ * all of them in ARG_MAX.
+ */
+static
+int
+spawn_copyinargs(userptr_t uargv, int *argcret, char ***argvret)
+{
+	userptr_t uarg;
+	char **argv;
+	char *buf;
+	size_t len, total;
+	int argc, i, result;
+
+	/* Count them. */
+	argc = 0;
+	while (1) {
+		if ((argc + 1) * sizeof(userptr_t) > ARG_MAX) {
+			return E2BIG;
+		}
+		result = copyin((const_userptr_t)((vaddr_t)uargv +
+						  argc * sizeof(userptr_t)),
+				&uarg, sizeof(uarg));
+		if (result) {
+			return result;
+		}
+		if (uarg == NULL) {
+			break;
+		}
+		argc++;
+	}
+
+	argv = kmalloc((argc + 1) * sizeof(char *));
+	buf = kmalloc(PATH_MAX);
+	if (argv == NULL || buf == NULL) {
+		kfree(argv);
+		kfree(buf);
+		return ENOMEM;
+	}
+
+	total = (argc + 1) * sizeof(userptr_t);
+	for (i=0; i<argc; i++) {
+		result = copyin((const_userptr_t)((vaddr_t)uargv +
+						  i * sizeof(userptr_t)),
+				&uarg, sizeof(uarg));
+		if (result == 0) {
+			result = copyinstr((const_userptr_t)uarg, buf,
+					   PATH_MAX, &len);
+		}
+		if (result == 0) {
+			total += len;
+			argv[i] = total > ARG_MAX ? NULL : kstrdup(buf);
+			if (argv[i] == NULL) {
+				result = total > ARG_MAX ? E2BIG : ENOMEM;
+			}
+		}
+		if (result) {
+			spawn_freeargs(i, argv);
+			kfree(buf);
+			return result == ENAMETOOLONG ? E2BIG : result;
+		}
+	}
+	argv[argc] = NULL;
+	kfree(buf);
+
+	*argcret = argc;
+	*argvret = argv;
+	return 0;
+}
+
+/*
+ * Set up the child's file table: the parent's files named in ACTIONS,
+ * or if ACTIONS is NULL, descriptors 0-2.
+ */
+static
+int
+spawn_files(struct proc *parent, struct proc *child,
+	    struct spawn_fdaction *actions, int nactions)
+{
+	int i, result;
+
+	child->p_ft = create_filetable();
+	if (child->p_ft == NULL) {
+		return ENOMEM;
+	}
+
+	if (actions == NULL) {
+		/* The child sets up its console as we would have. */
+		child->stdio_reserve = parent->stdio_reserve;
+		if (parent->p_ft == NULL) {
+			return 0;
+		}
+		for (i=0; i<3; i++) {
+			/* Any that aren't open are just skipped. */
+			(void)share_file_with_table(parent->p_ft, i,
+						    child->p_ft, i);
+		}
+		return 0;
+	}
+
+	child->stdio_reserve = true;
+	for (i=0; i<nactions; i++) {
+		if (parent->p_ft == NULL) {
+			return EBADF;
+		}
+		result = share_file_with_table(parent->p_ft,
+					       actions[i].sfa_parentfd,
+					       child->p_ft,
+					       actions[i].sfa_childfd);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * The child's first thread: load the program and go to user mode.
+ */
+static
+void
+spawn_start(void *data, unsigned long junk)
+{
+	struct spawnargs *sa = data;
+	struct addrspace *as;
+	vaddr_t entrypoint, stackptr;
+	userptr_t uargv;
+	int argc, result;
+
+	(void)junk;
+
+	argc = sa->sa_argc;
+	result = runprogram_load(sa->sa_path, argc, sa->sa_argv,
+				 &entrypoint, &stackptr, &uargv);
+	if (result) {
+		/* Clean up what we can; the parent does the rest. */
+		as_deactivate();
+		as = curproc_setas(NULL);
+		if (as != NULL) {
+			as_destroy(as);
+		}
+		proc_remthread(curthread);
+	}
+	else {
+		/* The parent is still in spawn, waiting for us. */
+		proc_addchild(sa->sa_parent, curproc);
+	}
+
+	/* After this SA belongs to the parent again. */
+	sa->sa_result = result;
+	V(sa->sa_loaded);
+
+	if (result) {
+		thread_exit();
+	}
+	enter_new_process(argc, uargv, stackptr, entrypoint);
+	panic("spawn: enter_new_process returned\n");
+}
+
+int
+sys_spawn(userptr_t upath, userptr_t uargv, userptr_t uactions,
+	  int nactions, pid_t *retval)
+{
+	struct proc *parent = curproc;
+	struct spawn_fdaction *actions;
+	struct spawnargs sa;
+	struct proc *child;
+	pid_t pid;
+	int result;
+
+	if (uactions != NULL && (nactions < 0 || nactions > OPEN_MAX)) {
+		return EINVAL;
+	}
+
+	sa.sa_path = kmalloc(PATH_MAX);
+	if (sa.sa_path == NULL) {
+		return ENOMEM;
+	}
+	result = copyinstr(upath, sa.sa_path, PATH_MAX, NULL);
+	if (result) {
+		kfree(sa.sa_path);
+		return result;
+	}
+	result = spawn_copyinargs(uargv, &sa.sa_argc, &sa.sa_argv);
+	if (result) {
+		kfree(sa.sa_path);
+		return result;
+	}
+
+	actions = NULL;
+	if (uactions != NULL) {
+		actions = kmalloc((nactions + 1) * sizeof(*actions));
+		if (actions == NULL) {
+			result = ENOMEM;
+			goto out;
+		}
+		result = copyin(uactions, actions,
+				nactions * sizeof(*actions));
+		if (result) {
+			goto out;
+		}
+	}
+
+	sa.sa_loaded = sem_create("spawn", 0);
+	if (sa.sa_loaded == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+	sa.sa_parent = parent;
+	sa.sa_result = 0;
+
+	child = proc_create_runprogram(sa.sa_path);
+	if (child == NULL) {
+		result = ENOMEM;
+		goto out_sem;
+	}
+	pid = child->pid;
+	result = spawn_files(parent, child, actions, nactions);
+	if (result) {
+		proc_destroy(child);
+		goto out_sem;
+	}
+
+	/*
+	 * If the load fails the child isn't ours yet, and its thread
+	 * has left, so this frees it outright.
+	 */
+	result = thread_fork(sa.sa_path, child, spawn_start, &sa, 0);
+	if (result) {
+		proc_destroy(child);
+		goto out_sem;
+	}
+	P(sa.sa_loaded);
+	result = sa.sa_result;
+	if (result) {
+		proc_destroy(child);
+		goto out_sem;
+	}
+
+	*retval = pid;
+ out_sem:
+	sem_destroy(sa.sa_loaded);
+ out:
+	kfree(actions);
+	spawn_freeargs(sa.sa_argc, sa.sa_argv);
+	kfree(sa.sa_path);
+	return result;
+}
+
+#endif /* OPT_A2 */
@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * User-level thread system calls: thread_create, thread_exit, and
+ * thread_join. The threads of a process share its address space and
+ * file table; each has its own kernel thread and kernel stack, and
+ * so its own trapframe. See struct uthreadset in <proc.h>.
+ *
+ * _exit from any thread ends the whole process. The other threads
+ * notice on their next trip back toward user mode (a system call
+ * return or a timer interrupt) and leave via uthread_checkexit(); the
+ * thread in _exit waits for them before tearing the process down.
+ * Threads asleep in futex waits, thread_join or waitpid are woken and
+ * return EINTR, and so leave the same way.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include <futex.h>
+
+/*
+ * Get the current process's thread set, creating it if needed. This
+ * is only called by thread_create; until the first one succeeds the
+ * process has exactly one thread, so there is no race here.
+ */
+static
+struct uthreadset *
+uthreadset_get(struct proc *p)
+{
+	struct uthreadset *us;
+	struct uthread *first;
+
+	if (p->p_uthreads != NULL) {
+		return p->p_uthreads;
+	}
+
+	us = kmalloc(sizeof(*us));
+	if (us == NULL) {
+		return NULL;
+	}
+	first = kmalloc(sizeof(*first));
+	if (first == NULL) {
+		kfree(us);
+		return NULL;
+	}
+	us->us_lock = lock_create("uthreads");
+	if (us->us_lock == NULL) {
+		kfree(first);
+		kfree(us);
+		return NULL;
+	}
+	us->us_cv = cv_create("uthreads");
+	if (us->us_cv == NULL) {
+		lock_destroy(us->us_lock);
+		kfree(first);
+		kfree(us);
+		return NULL;
+	}
+
+	/* The thread that got here is the original one. */
+	KASSERT(curthread->t_tid == 0);
+	bzero(first, sizeof(*first));
+	first->ut_tid = 0;
+
+	us->us_threads = first;
+	us->us_nexttid = 1;
+	us->us_live = 1;
+	us->us_exiting = false;
+
+	p->p_uthreads = us;
+	return us;
+}
+
+static
+struct uthread *
+uthreadset_find(struct uthreadset *us, unsigned tid)
+{
+	struct uthread *ut;
+
+	KASSERT(lock_do_i_hold(us->us_lock));
+	for (ut = us->us_threads; ut != NULL; ut = ut->ut_next) {
+		if (ut->ut_tid == tid) {
+			return ut;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Leave the process: record the exit value, detach, and exit. Called
+ * with us_lock held. This thread must not be the last one; the last
+ * one goes through sys__exit instead.
+ *
+ * Detaching happens before us_live drops, so by the time the thread
+ * in _exit sees us_live reach 1 nobody else refers to the process.
+ */
+static
+void
+uthread_leave(struct uthreadset *us, int exitval)
+{
+	struct uthread *ut;
+
+	KASSERT(lock_do_i_hold(us->us_lock));
+	KASSERT(us->us_live > 1);
+
+	ut = uthreadset_find(us, curthread->t_tid);
+	KASSERT(ut != NULL);
+	ut->ut_exited = true;
+	ut->ut_exitval = exitval;
+
+	as_deactivate();
+	proc_remthread(curthread);
+
+	us->us_live--;
+	cv_broadcast(us->us_cv, us->us_lock);
+	lock_release(us->us_lock);
+
+	thread_exit();
+}
+
+/*
+ * Called on the way back to user mode. If some thread has called
+ * _exit, leave quietly instead. The unlocked peek keeps this cheap
+ * in the usual case; us_exiting never goes back to false.
+ */
+bool
+uthread_exiting(void)
+{
+	struct proc *p = curproc;
+
+	return p != NULL && p != kproc && p->p_uthreads != NULL &&
+		p->p_uthreads->us_exiting;
+}
+
+void
+uthread_checkexit(void)
+{
+	if (!uthread_exiting()) {
+		return;
+	}
+
+	lock_acquire(curproc->p_uthreads->us_lock);
+	uthread_leave(curproc->p_uthreads, 0);
+}
+
+/*
+ * Called by sys__exit before it tears down the process. Tell the
+ * other threads to leave and wait for them. If some other thread is
+ * already doing this, just leave ourselves.
+ */
+void
+uthread_exitall(struct proc *p)
+{
+	struct uthreadset *us = p->p_uthreads;
+
+	if (us == NULL) {
+		return;
+	}
+
+	lock_acquire(us->us_lock);
+	if (us->us_exiting) {
+		uthread_leave(us, 0);
+	}
+	us->us_exiting = true;
+	/* Wake anyone in thread_join so they can leave. */
+	cv_broadcast(us->us_cv, us->us_lock);
+	/* ...and anyone in a futex wait or waitpid. */
+	futex_interrupt(p);
+#if OPT_A2
+	lock_acquire(p->p_waitlock);
+	cv_broadcast(p->p_waitcv, p->p_waitlock);
+	lock_release(p->p_waitlock);
+#endif
+	while (us->us_live > 1) {
+		cv_wait(us->us_cv, us->us_lock);
+	}
+	lock_release(us->us_lock);
+}
+
+/*
+ * Startup function for new user threads.
+ */
+static
+void
+uthread_start(void *data1, unsigned long data2)
+{
+	struct uthread *ut = data1;
+
+	(void)data2;
+
+	/* ut stays put: it can't be joined until we exit. */
+	curthread->t_tid = ut->ut_tid;
+	enter_new_thread(ut->ut_arg, ut->ut_stack, ut->ut_entry);
+}
+
+/*
+ * thread_create: start a new thread in the current process, running
+ * func(arg) on the user stack whose top is STACK. Returns the new
+ * thread's id. The thread should end by calling thread_exit;
+ * returning from func has nowhere to go.
+ */
+int
+sys_thread_create(userptr_t func, userptr_t arg, userptr_t stack,
+		  int32_t *retval)
+{
+	struct proc *p = curproc;
+	struct uthreadset *us;
+	struct uthread *ut;
+	vaddr_t entry, sp;
+	unsigned tid;
+	int result;
+
+	entry = (vaddr_t)func;
+	/* Keep the stack 8-byte aligned, as the MIPS ABI wants. */
+	sp = (vaddr_t)stack & ~(vaddr_t)7;
+	if (entry == 0 || entry >= USERSPACETOP ||
+	    sp == 0 || sp > USERSPACETOP) {
+		return EFAULT;
+	}
+
+	ut = kmalloc(sizeof(*ut));
+	if (ut == NULL) {
+		return ENOMEM;
+	}
+	us = uthreadset_get(p);
+	if (us == NULL) {
+		kfree(ut);
+		return ENOMEM;
+	}
+
+	bzero(ut, sizeof(*ut));
+	ut->ut_entry = entry;
+	ut->ut_arg = (vaddr_t)arg;
+	ut->ut_stack = sp;
+
+	lock_acquire(us->us_lock);
+	tid = us->us_nexttid++;
+	ut->ut_tid = tid;
+	ut->ut_next = us->us_threads;
+	us->us_threads = ut;
+	us->us_live++;
+	lock_release(us->us_lock);
+
+	result = thread_fork(p->p_name, p, uthread_start, ut, 0);
+	if (result) {
+		struct uthread **utp;
+
+		lock_acquire(us->us_lock);
+		for (utp = &us->us_threads; *utp != ut;
+		     utp = &(*utp)->ut_next) {
+			KASSERT(*utp != NULL);
+		}
+		*utp = ut->ut_next;
+		us->us_live--;
+		lock_release(us->us_lock);
+		kfree(ut);
+		return result;
+	}
+
+	/*
+	 * Not ut->ut_tid: by now the thread may have exited and been
+	 * joined, and ut freed.
+	 */
+	*retval = tid;
+	return 0;
+}
+
+/*
+ * thread_exit: end the calling thread. If it is the last one, this
+ * is the same as _exit(exitval).
+ */
+void
+sys_thread_exit(int exitval)
+{
+	struct uthreadset *us = curproc->p_uthreads;
+
+	if (us != NULL) {
+		lock_acquire(us->us_lock);
+		if (us->us_live > 1) {
+			uthread_leave(us, exitval);
+		}
+		lock_release(us->us_lock);
+	}
+	sys__exit(exitval);
+}
+
+/*
+ * thread_join: wait for thread TID to exit and collect its exit
+ * value. Each thread can be joined once; after that its id is gone.
+ */
+int
+sys_thread_join(unsigned tid, userptr_t status)
+{
+	struct uthreadset *us = curproc->p_uthreads;
+	struct uthread *ut, **utp;
+	int exitval;
+	int result;
+
+	if (tid == curthread->t_tid) {
+		return EINVAL;
+	}
+	if (us == NULL) {
+		return ESRCH;
+	}
+
+	lock_acquire(us->us_lock);
+	ut = uthreadset_find(us, tid);
+	if (ut == NULL) {
+		lock_release(us->us_lock);
+		return ESRCH;
+	}
+	if (ut->ut_joining) {
+		lock_release(us->us_lock);
+		return EINVAL;
+	}
+	ut->ut_joining = true;
+	while (!ut->ut_exited && !us->us_exiting) {
+		cv_wait(us->us_cv, us->us_lock);
+	}
+	if (!ut->ut_exited) {
+		/* The process is exiting; we'll leave on the way out. */
+		ut->ut_joining = false;
+		lock_release(us->us_lock);
+		return EINTR;
+	}
+	exitval = ut->ut_exitval;
+	for (utp = &us->us_threads; *utp != ut; utp = &(*utp)->ut_next) {
+		KASSERT(*utp != NULL);
+	}
+	*utp = ut->ut_next;
+	lock_release(us->us_lock);
+	kfree(ut);
+
+	if (status != NULL) {
+		result = copyout(&exitval, status, sizeof(exitval));
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
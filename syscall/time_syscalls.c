@@ -28,6 +28,9 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <lib.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +59,43 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Sleep for the requested time, rounded up to whole hardclocks.
+ * Since nothing interrupts the sleep, there's never any time left
+ * over to report in REM.
+ *
+ * Long sleeps are done an hour at a time so the tick count can't
+ * overflow.
+ */
+int
+sys_nanosleep(const_userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec ts;
+	int result;
+
+	result = copyin(user_req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	while (ts.tv_sec > 3600) {
+		thread_sleep_ticks(3600 * HZ);
+		ts.tv_sec -= 3600;
+	}
+	thread_sleep_ticks(ts.tv_sec * HZ +
+			   DIVROUNDUP((uint32_t)ts.tv_nsec, NSEC_PER_HARDCLOCK));
+
+	if (user_rem != NULL) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 0;
+		result = copyout(&ts, user_rem, sizeof(ts));
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Atomic operation and per-cpu variable test.
+ *
+ * One thread per cpu, each bound to its cpu, hammers on a shared
+ * counter with atomic_inc and on another with an atomic_cas loop,
+ * and counts its iterations in a per-cpu variable. At the end the
+ * shared counters must come out exact, and each cpu's copy of the
+ * per-cpu counter must hold just its own thread's count.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <atomic.h>
+#include <percpu.h>
+#include <synch.h>
+#include <thread.h>
+#include <test.h>
+
+#define ATOMICLOOPS 50000
+
+static struct semaphore *atomicdone;
+static volatile bool atomicgo;
+static volatile uint32_t addcount;
+static volatile uint32_t cascount;
+static volatile uint32_t casfails;
+static PERCPU_DEFINE(uint32_t, atomicloops) = 0;
+
+static
+void
+atomictestthread(void *junk, unsigned long num)
+{
+	uint32_t old;
+	int i, result;
+
+	(void)junk;
+
+	result = thread_setaffinity(1U << num);
+	if (result) {
+		panic("atomictest: thread_setaffinity failed: %s\n",
+		      strerror(result));
+	}
+
+	while (!atomicgo) {
+		thread_yield();
+	}
+
+	for (i=0; i<ATOMICLOOPS; i++) {
+		atomic_inc(&addcount);
+		do {
+			old = atomic_load(&cascount);
+			if (atomic_cas(&cascount, old, old + 2)) {
+				break;
+			}
+			atomic_inc(&casfails);
+		} while (1);
+		atomic_inc(&PERCPU_CUR(atomicloops));
+	}
+	V(atomicdone);
+}
+
+int
+atomictest(int nargs, char **args)
+{
+	struct cpu *c;
+	uint32_t total, old;
+	unsigned ncpus, i;
+	char name[16];
+	int result;
+
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: at1\n");
+		return EINVAL;
+	}
+
+	/* Check the return values single-threaded first. */
+	old = 5;
+	KASSERT(atomic_add(&old, 3) == 8);
+	KASSERT(atomic_dec(&old) == 7);
+	KASSERT(atomic_swap(&old, 12) == 7 && old == 12);
+	KASSERT(!atomic_cas(&old, 11, 1) && old == 12);
+	KASSERT(atomic_cas(&old, 12, 1) && old == 1);
+	KASSERT(atomic_or(&old, 6) == 1 && old == 7);
+	KASSERT(atomic_and(&old, 5) == 7 && old == 5);
+
+	atomicdone = sem_create("atomictest", 0);
+	if (atomicdone == NULL) {
+		panic("atomictest: sem_create failed\n");
+	}
+
+	kprintf("Starting atomic/per-cpu test...\n");
+	atomicgo = false;
+	addcount = cascount = casfails = 0;
+	PERCPU_FOREACH(c, i) {
+		PERCPU(atomicloops, c) = 0;
+	}
+
+	ncpus = cpu_count();
+	for (i=0; i<ncpus; i++) {
+		snprintf(name, sizeof(name), "atomictest%u", i);
+		result = thread_fork(name, NULL, atomictestthread, NULL, i);
+		if (result) {
+			panic("atomictest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	atomicgo = true;
+	for (i=0; i<ncpus; i++) {
+		P(atomicdone);
+	}
+
+	kprintf("%u cpus, %u cas retries\n", ncpus, casfails);
+	if (addcount != ncpus * ATOMICLOOPS) {
+		panic("atomictest: atomic_add count %u, expected %u\n",
+		      addcount, ncpus * ATOMICLOOPS);
+	}
+	if (cascount != 2 * ncpus * ATOMICLOOPS) {
+		panic("atomictest: atomic_cas count %u, expected %u\n",
+		      cascount, 2 * ncpus * ATOMICLOOPS);
+	}
+	total = 0;
+	PERCPU_FOREACH(c, i) {
+		if (PERCPU(atomicloops, c) != ATOMICLOOPS) {
+			panic("atomictest: cpu %u counted %u, expected %u\n",
+			      i, PERCPU(atomicloops, c), ATOMICLOOPS);
+		}
+		total += PERCPU(atomicloops, c);
+	}
+	KASSERT(total == ncpus * ATOMICLOOPS);
+	kprintf("Atomic/per-cpu test done.\n");
+
+	sem_destroy(atomicdone);
+	return 0;
+}
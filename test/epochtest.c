@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Epoch reclamation stress test.
+ *
+ * Readers (one per cpu) repeatedly look at a shared object in an
+ * epoch read section, while writers replace it and retire the old
+ * one with epoch_call. Retiring poisons the object before freeing
+ * it, so a reader that sees poison (or a torn object) caught an
+ * object being reclaimed under it.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <atomic.h>
+#include <epoch.h>
+#include <synch.h>
+#include <thread.h>
+#include <test.h>
+
+#define NWRITERS   2
+#define READLOOPS  20000
+#define WRITELOOPS 2000
+#define READWORK   20	/* Loop iterations inside the read section */
+
+#define EO_MAGIC 0xe90c0b1e
+#define EO_DEAD  0xdeadbeef
+
+struct epochobj {
+	uint32_t eo_magic;
+	uint32_t eo_gen;
+	uint32_t eo_check;	/* ~eo_gen */
+};
+
+static struct epochobj *volatile epochshared;
+static struct semaphore *epochdone;
+static volatile uint32_t epochgen;
+static volatile uint32_t epochretired;
+static volatile uint32_t epochreads;
+
+static
+struct epochobj *
+epochobj_create(void)
+{
+	struct epochobj *eo;
+
+	eo = kmalloc(sizeof(*eo));
+	if (eo == NULL) {
+		panic("epochtest: Out of memory\n");
+	}
+	eo->eo_gen = atomic_inc(&epochgen);
+	eo->eo_check = ~eo->eo_gen;
+	eo->eo_magic = EO_MAGIC;
+	return eo;
+}
+
+static
+void
+epochobj_check(struct epochobj *eo, const char *what)
+{
+	if (eo->eo_magic != EO_MAGIC || eo->eo_check != ~eo->eo_gen) {
+		panic("epochtest: %s object %p: magic 0x%x gen %u "
+		      "check 0x%x\n", what, eo, eo->eo_magic,
+		      eo->eo_gen, eo->eo_check);
+	}
+}
+
+/*
+ * epoch_call function: poison and free an old object.
+ */
+static
+void
+epochobj_retire(void *p)
+{
+	struct epochobj *eo = p;
+
+	epochobj_check(eo, "retired");
+	eo->eo_magic = EO_DEAD;
+	eo->eo_check = EO_DEAD;
+	atomic_inc(&epochretired);
+	kfree(eo);
+}
+
+static
+void
+epochreader(void *junk, unsigned long num)
+{
+	struct epochobj *eo;
+	uint32_t gen;
+	volatile int j;
+	int i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<READLOOPS; i++) {
+		epoch_enter();
+		eo = epochshared;
+		epochobj_check(eo, "shared");
+		gen = eo->eo_gen;
+		for (j=0; j<READWORK; j++);
+		epochobj_check(eo, "shared");
+		KASSERT(eo->eo_gen == gen);
+		epoch_exit();
+	}
+	atomic_add(&epochreads, READLOOPS);
+	V(epochdone);
+}
+
+static
+void
+epochwriter(void *junk, unsigned long num)
+{
+	struct epochobj *eo, *old;
+	int i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<WRITELOOPS; i++) {
+		eo = epochobj_create();
+		old = spinlock_ptr_swap((void *volatile *)&epochshared, eo);
+		if (epoch_call(epochobj_retire, old)) {
+			/* Out of memory; wait it out ourselves. */
+			epoch_synchronize();
+			epochobj_retire(old);
+		}
+		if (i % 64 == 0) {
+			thread_yield();
+		}
+	}
+	V(epochdone);
+}
+
+int
+epochtest(int nargs, char **args)
+{
+	unsigned nreaders, i, waited;
+	char name[16];
+	int result;
+
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: ep1\n");
+		return EINVAL;
+	}
+
+	epochdone = sem_create("epochtest", 0);
+	if (epochdone == NULL) {
+		panic("epochtest: sem_create failed\n");
+	}
+
+	kprintf("Starting epoch reclamation test...\n");
+	epochgen = 0;
+	epochretired = 0;
+	epochreads = 0;
+	epochshared = epochobj_create();
+
+	nreaders = cpu_count();
+	for (i=0; i<nreaders; i++) {
+		snprintf(name, sizeof(name), "epochreader%u", i);
+		result = thread_fork(name, NULL, epochreader, NULL, i);
+		if (result) {
+			panic("epochtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NWRITERS; i++) {
+		snprintf(name, sizeof(name), "epochwriter%u", i);
+		result = thread_fork(name, NULL, epochwriter, NULL, i);
+		if (result) {
+			panic("epochtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nreaders + NWRITERS; i++) {
+		P(epochdone);
+	}
+
+	/* Retire the last one too, and wait for everything to be freed. */
+	epochobj_check(epochshared, "final");
+	if (epoch_call(epochobj_retire, epochshared)) {
+		epoch_synchronize();
+		epochobj_retire(epochshared);
+	}
+	epochshared = NULL;
+	epoch_synchronize();
+	for (waited = 0; epochretired < epochgen; waited++) {
+		if (waited > 10 * HZ) {
+			panic("epochtest: only %u of %u objects reclaimed\n",
+			      epochretired, epochgen);
+		}
+		thread_sleep_ticks(1);
+	}
+
+	kprintf("%u reads, %u objects reclaimed\n", epochreads,
+		epochretired);
+	kprintf("Epoch reclamation test done.\n");
+
+	sem_destroy(epochdone);
+	return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Futex lock benchmark.
+ *
+ * There's no userland in this tree, so this stands in for a user
+ * test: it builds the usual three-state futex mutex (0 unlocked, 1
+ * locked, 2 locked with waiters) on futex_wait/futex_wake, keyed on
+ * the physical address of a kernel word, just as a user-level thread
+ * library would on top of the futex system call.
+ *
+ * The lock is hammered by one thread (uncontended) and then by one
+ * thread per cpu (contended). We report lock/unlock pairs per second
+ * and how many times the lock had to go into the futex code; the
+ * uncontended case should never need to.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <vm.h>
+#include <futex.h>
+#include <test.h>
+
+#define FUTEXLOOPS  20000
+#define INSIDEWORK  20		/* Loop iterations holding the lock */
+
+static void *volatile fxword;
+static paddr_t fxaddr;
+static struct semaphore *fxdone;
+static volatile unsigned fxcount;
+static volatile unsigned fxwaits;
+static volatile unsigned fxwakes;
+
+static
+void
+fxlock(void)
+{
+	if (spinlock_ptr_cas(&fxword, (void *)0, (void *)1)) {
+		return;
+	}
+	while (spinlock_ptr_swap(&fxword, (void *)2) != (void *)0) {
+		fxwaits++;
+		futex_wait(fxaddr, 2);
+	}
+}
+
+static
+void
+fxunlock(void)
+{
+	if (spinlock_ptr_swap(&fxword, (void *)0) == (void *)2) {
+		fxwakes++;
+		futex_wake(fxaddr, 1);
+	}
+}
+
+static
+void
+fxthread(void *junk, unsigned long num)
+{
+	volatile int j;
+	int i, result;
+
+	(void)junk;
+
+	result = thread_setaffinity(1U << num);
+	if (result) {
+		panic("futexbench: thread_setaffinity failed: %s\n",
+		      strerror(result));
+	}
+
+	for (i=0; i<FUTEXLOOPS; i++) {
+		fxlock();
+		fxcount++;
+		for (j=0; j<INSIDEWORK; j++);
+		fxunlock();
+	}
+	V(fxdone);
+}
+
+static
+void
+futexbench(unsigned nthreads)
+{
+	time_t beforesecs, aftersecs, secs;
+	uint32_t beforensecs, afternsecs, nsecs;
+	unsigned long msecs;
+	char name[16];
+	unsigned i;
+	int result;
+
+	fxword = (void *)0;
+	fxcount = 0;
+	fxwaits = 0;
+	fxwakes = 0;
+
+	gettime(&beforesecs, &beforensecs);
+	for (i=0; i<nthreads; i++) {
+		snprintf(name, sizeof(name), "futexbench%u", i);
+		result = thread_fork(name, NULL, fxthread, NULL, i);
+		if (result) {
+			panic("futexbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(fxdone);
+	}
+	gettime(&aftersecs, &afternsecs);
+	getinterval(beforesecs, beforensecs, aftersecs, afternsecs,
+		    &secs, &nsecs);
+	msecs = (unsigned long)secs * 1000 + nsecs / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+
+	KASSERT(fxcount == nthreads * FUTEXLOOPS);
+	KASSERT(fxword == (void *)0);
+
+	kprintf("%2u threads: %8lu lock/unlock/sec, %u waits, %u wakes\n",
+		nthreads, (unsigned long)fxcount * 1000 / msecs,
+		fxwaits, fxwakes);
+}
+
+int
+futextest(int nargs, char **args)
+{
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: fx1\n");
+		return EINVAL;
+	}
+
+	fxdone = sem_create("futexbench", 0);
+	if (fxdone == NULL) {
+		panic("futextest: sem_create failed\n");
+	}
+	fxaddr = KVADDR_TO_PADDR((vaddr_t)&fxword);
+
+	kprintf("Starting futex lock benchmark...\n");
+	futexbench(1);
+	if (cpu_count() > 1) {
+		futexbench(cpu_count());
+	}
+	kprintf("Futex lock benchmark done.\n");
+
+	sem_destroy(fxdone);
+	return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Process table benchmark.
+ *
+ * Creates N child processes of the kernel process, looks each one up
+ * by pid, has them all exit, and then waits for each one (half by
+ * pid, half as "any child"), timing each phase; with hashed lookup
+ * and per-parent child lists and exit queues the cost per process
+ * should stay flat as N grows. Also checks WNOHANG, that exit
+ * statuses come back right, and that pids aren't reused by the next
+ * batch.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/wait.h>
+#include <limits.h>
+#include <lib.h>
+#include <clock.h>
+#include <bitmap.h>
+#include <synch.h>
+#include <proc.h>
+#include <test.h>
+#include "opt-A2.h"
+
+#if OPT_A2
+
+static const unsigned procbench_sizes[] = { 16, 256, 1024, 3000 };
+
+static time_t benchsecs;
+static uint32_t benchnsecs;
+
+static
+void
+procbench_start(void)
+{
+	gettime(&benchsecs, &benchnsecs);
+}
+
+/*
+ * Print the time since procbench_start per each of N operations.
+ */
+static
+void
+procbench_stop(const char *what, unsigned n)
+{
+	time_t aftersecs, secs;
+	uint32_t afternsecs, nsecs;
+	uint64_t usecs;
+
+	gettime(&aftersecs, &afternsecs);
+	getinterval(benchsecs, benchnsecs, aftersecs, afternsecs,
+		    &secs, &nsecs);
+	usecs = (uint64_t)secs * 1000000 + nsecs / 1000;
+	kprintf("  %-8s %6u us/proc\n", what, (unsigned)(usecs / n));
+}
+
+int
+procbench(int nargs, char **args)
+{
+	struct bitmap *lastpids, *pids;
+	struct proc **procs;
+	pid_t *pidv;
+	pid_t pid;
+	unsigned n, i, s;
+	int status, result;
+
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: pt1\n");
+		return EINVAL;
+	}
+
+	lastpids = bitmap_create(PID_MAX + 1);
+	if (lastpids == NULL) {
+		return ENOMEM;
+	}
+
+	kprintf("Starting process table benchmark...\n");
+	for (s=0; s<sizeof(procbench_sizes)/sizeof(procbench_sizes[0]); s++) {
+		n = procbench_sizes[s];
+		procs = kmalloc(n * sizeof(struct proc *));
+		pidv = kmalloc(n * sizeof(pid_t));
+		pids = bitmap_create(PID_MAX + 1);
+		if (procs == NULL || pidv == NULL || pids == NULL) {
+			panic("procbench: Out of memory\n");
+		}
+		kprintf("%u processes:\n", n);
+
+		procbench_start();
+		for (i=0; i<n; i++) {
+			procs[i] = proc_create_runprogram("procbench");
+			if (procs[i] == NULL) {
+				panic("procbench: proc_create_runprogram "
+				      "failed at %u\n", i);
+			}
+			proc_addchild(kproc, procs[i]);
+			pidv[i] = procs[i]->pid;
+		}
+		procbench_stop("create", n);
+
+		procbench_start();
+		for (i=0; i<n; i++) {
+			if (proc_pid_get(pidv[i]) != procs[i] ||
+			    !is_proc_child(kproc, pidv[i])) {
+				panic("procbench: lookup of pid %d failed\n",
+				      pidv[i]);
+			}
+		}
+		procbench_stop("lookup", n);
+
+		result = proc_wait(kproc, -1, WNOHANG, &pid, &status);
+		if (result || pid != 0) {
+			panic("procbench: WNOHANG wait got pid %d (%d)\n",
+			      pid, result);
+		}
+		result = proc_wait(kproc, pidv[0], WNOHANG, &pid, &status);
+		if (result || pid != 0) {
+			panic("procbench: WNOHANG wait for pid %d got "
+			      "pid %d (%d)\n", pidv[0], pid, result);
+		}
+
+		/* Exit in the opposite order from waiting. */
+		procbench_start();
+		for (i=n; i-- > 0; ) {
+			procs[i]->exitcode = _MKWAIT_EXIT(pidv[i] & 0xff);
+			proc_destroy(procs[i]);
+		}
+		procbench_stop("exit", n);
+#ifdef UW
+		/* That was the last process; collect the wakeup. */
+		P(no_proc_sem);
+#endif
+
+		/*
+		 * Wait for the even ones by pid, then the rest as any
+		 * child, which should come back in exit order (the
+		 * sizes are all even).
+		 */
+		procbench_start();
+		for (i=0; i<n; i++) {
+			if (i < n/2) {
+				result = proc_wait(kproc, pidv[i*2], 0,
+						   &pid, &status);
+			}
+			else {
+				result = proc_wait(kproc, -1, 0,
+						   &pid, &status);
+			}
+			if (result) {
+				panic("procbench: proc_wait %u: %s\n",
+				      i, strerror(result));
+			}
+			if (i >= n/2 &&
+			    pid != pidv[n - 1 - (i - n/2)*2]) {
+				panic("procbench: wait for any got pid %d "
+				      "out of order\n", pid);
+			}
+			if (status != _MKWAIT_EXIT(pid & 0xff)) {
+				panic("procbench: pid %d status %d\n",
+				      pid, status);
+			}
+		}
+		procbench_stop("wait", n);
+
+		result = proc_wait(kproc, -1, WNOHANG, &pid, &status);
+		if (result != ECHILD) {
+			panic("procbench: wait with no children: %d\n",
+			      result);
+		}
+
+		for (i=0; i<n; i++) {
+			KASSERT(proc_pid_get(pidv[i]) == NULL);
+			if (bitmap_isset(lastpids, pidv[i])) {
+				panic("procbench: pid %d reused right away\n",
+				      pidv[i]);
+			}
+			bitmap_mark(pids, pidv[i]);
+		}
+		bitmap_destroy(lastpids);
+		lastpids = pids;
+		kfree(pidv);
+		kfree(procs);
+	}
+	bitmap_destroy(lastpids);
+	kprintf("Process table benchmark done.\n");
+	return 0;
+}
+
+#endif /* OPT_A2 */
@@ -0,0 +1,436 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Ring buffer tests.
+ *
+ * rb1 checks the ring single-threaded (full/empty, ordering, batches
+ * that wrap around), then concurrently: an SPSC ring between two
+ * threads, an MPMC ring with a producer and consumer per cpu, and an
+ * interrupt-safe ring filled from a timeout.
+ *
+ * rb2 measures throughput for each mode, one item and a batch at a
+ * time.
+ *
+ * Items are (producer number + 1) << ITEMSHIFT | sequence number, so
+ * consumers can check each producer's items arrive in order.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <atomic.h>
+#include <ringbuf.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <test.h>
+
+#define RINGSIZE   64
+#define MAXBATCH   16
+#define MAXTHREADS 32		/* Producers or consumers */
+#define ITEMSHIFT  20
+#define ITEMS      20000	/* Per producer */
+#define BENCHITEMS 100000	/* In total */
+#define INTRITEMS  200		/* One per hardclock */
+
+#define ITEM(prod, seq) \
+	((void *)(uintptr_t)(((prod) + 1) << ITEMSHIFT | (seq)))
+#define ITEM_PROD(p)	(((uintptr_t)(p) >> ITEMSHIFT) - 1)
+#define ITEM_SEQ(p)	((uintptr_t)(p) & ((1 << ITEMSHIFT) - 1))
+
+static struct ringbuf *testring;
+static struct semaphore *ringdone;
+static volatile bool ringgo;
+static unsigned ringbatch;		/* Max batch size; 0 for random */
+static unsigned ringperprod;		/* Items per producer */
+static volatile uint32_t ringconsumed;
+static volatile uint32_t ringtotal;	/* Items to consume in all */
+
+////////////////////////////////////////////////////////////
+// single-threaded
+
+static
+void
+ringbasic(unsigned flags)
+{
+	void *batch[MAXBATCH];
+	struct ringbuf *rb;
+	unsigned i, n, got, put, nextput, nextget;
+
+	rb = ringbuf_create(RINGSIZE - 3, flags);
+	KASSERT(rb != NULL);
+	KASSERT(ringbuf_size(rb) == RINGSIZE);
+
+	/* Fill it up, check it's full, empty it. */
+	KASSERT(ringbuf_get(rb) == NULL);
+	for (i=0; i<RINGSIZE; i++) {
+		KASSERT(ringbuf_put(rb, ITEM(0, i)) == 0);
+	}
+	KASSERT(ringbuf_count(rb) == RINGSIZE);
+	KASSERT(ringbuf_put(rb, ITEM(0, i)) == ENOSPC);
+	KASSERT(ringbuf_putn(rb, batch, 1) == 0);
+	for (i=0; i<RINGSIZE; i++) {
+		KASSERT(ringbuf_get(rb) == ITEM(0, i));
+	}
+	KASSERT(ringbuf_get(rb) == NULL);
+	KASSERT(ringbuf_getn(rb, batch, MAXBATCH) == 0);
+	KASSERT(ringbuf_count(rb) == 0);
+
+	/* Random batches, going round the ring many times. */
+	nextput = nextget = 0;
+	for (i=0; i<50 * RINGSIZE; i++) {
+		n = random() % MAXBATCH + 1;
+		for (put=0; put<n; put++) {
+			batch[put] = ITEM(0, nextput + put);
+		}
+		put = ringbuf_putn(rb, batch, n);
+		KASSERT(put == n || put == RINGSIZE - (nextput - nextget));
+		nextput += put;
+		KASSERT(ringbuf_count(rb) == nextput - nextget);
+
+		n = random() % MAXBATCH + 1;
+		got = ringbuf_getn(rb, batch, n);
+		KASSERT(got == n || got == nextput - nextget);
+		for (n=0; n<got; n++) {
+			KASSERT(batch[n] == ITEM(0, nextget + n));
+		}
+		nextget += got;
+	}
+	while (ringbuf_get(rb) != NULL) {
+		nextget++;
+	}
+	KASSERT(nextget == nextput);
+	ringbuf_destroy(rb);
+}
+
+////////////////////////////////////////////////////////////
+// threads
+
+static
+unsigned
+ringbatchsize(void)
+{
+	return ringbatch > 0 ? ringbatch : random() % MAXBATCH + 1;
+}
+
+static
+void
+ringproducer(void *junk, unsigned long prod)
+{
+	void *batch[MAXBATCH];
+	unsigned seq, n, i;
+
+	(void)junk;
+
+	while (!ringgo) {
+		thread_yield();
+	}
+
+	seq = 0;
+	while (seq < ringperprod) {
+		n = ringbatchsize();
+		if (n > ringperprod - seq) {
+			n = ringperprod - seq;
+		}
+		for (i=0; i<n; i++) {
+			batch[i] = ITEM(prod, seq + i);
+		}
+		i = 0;
+		while (i < n) {
+			i += ringbuf_putn(testring, batch + i, n - i);
+			if (i < n) {
+				thread_yield();
+			}
+		}
+		seq += n;
+	}
+	V(ringdone);
+}
+
+static
+void
+ringconsumer(void *junk, unsigned long cons)
+{
+	void *batch[MAXBATCH];
+	unsigned next[MAXTHREADS];
+	unsigned n, i, prod;
+
+	(void)junk;
+	(void)cons;
+
+	bzero(next, sizeof(next));
+
+	while (!ringgo) {
+		thread_yield();
+	}
+
+	while (ringconsumed < ringtotal) {
+		n = ringbuf_getn(testring, batch, ringbatchsize());
+		if (n == 0) {
+			thread_yield();
+			continue;
+		}
+		for (i=0; i<n; i++) {
+			prod = ITEM_PROD(batch[i]);
+			KASSERT(prod < MAXTHREADS);
+			if (ITEM_SEQ(batch[i]) < next[prod]) {
+				panic("ringbuftest: producer %u item %u "
+				      "after %u\n", prod,
+				      (unsigned)ITEM_SEQ(batch[i]),
+				      next[prod] - 1);
+			}
+			next[prod] = ITEM_SEQ(batch[i]) + 1;
+		}
+		atomic_add(&ringconsumed, n);
+	}
+	V(ringdone);
+}
+
+/*
+ * Run NPROD producers and NCONS consumers on a fresh ring; returns
+ * the elapsed time in ms.
+ */
+static
+unsigned long
+ringrun(unsigned flags, unsigned nprod, unsigned ncons, unsigned perprod,
+	unsigned batch)
+{
+	time_t beforesecs, aftersecs, secs;
+	uint32_t beforensecs, afternsecs, nsecs;
+	unsigned long msecs;
+	char name[16];
+	unsigned i;
+	int result;
+
+	KASSERT(nprod <= MAXTHREADS);
+	KASSERT(perprod < (1U << ITEMSHIFT));
+
+	testring = ringbuf_create(RINGSIZE, flags);
+	if (testring == NULL) {
+		panic("ringbuftest: ringbuf_create failed\n");
+	}
+	ringgo = false;
+	ringbatch = batch;
+	ringperprod = perprod;
+	ringconsumed = 0;
+	ringtotal = nprod * perprod;
+
+	for (i=0; i<nprod; i++) {
+		snprintf(name, sizeof(name), "ringprod%u", i);
+		result = thread_fork(name, NULL, ringproducer, NULL, i);
+		if (result) {
+			panic("ringbuftest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<ncons; i++) {
+		snprintf(name, sizeof(name), "ringcons%u", i);
+		result = thread_fork(name, NULL, ringconsumer, NULL, i);
+		if (result) {
+			panic("ringbuftest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	gettime(&beforesecs, &beforensecs);
+	ringgo = true;
+	for (i=0; i<nprod + ncons; i++) {
+		P(ringdone);
+	}
+	gettime(&aftersecs, &afternsecs);
+	getinterval(beforesecs, beforensecs, aftersecs, afternsecs,
+		    &secs, &nsecs);
+	msecs = (unsigned long)secs * 1000 + nsecs / 1000000;
+
+	KASSERT(ringconsumed == ringtotal);
+	KASSERT(ringbuf_count(testring) == 0);
+	ringbuf_destroy(testring);
+	testring = NULL;
+
+	return msecs > 0 ? msecs : 1;
+}
+
+////////////////////////////////////////////////////////////
+// interrupts
+
+static volatile unsigned intrseq;
+
+/*
+ * Timeout callback: put an item, and come back next tick. The
+ * consumer runs on the same cpu, so it never sees us half done.
+ */
+static
+void
+ringintr(void *data)
+{
+	struct timeout *to = data;
+
+	if (ringbuf_put(testring, ITEM(0, intrseq)) == 0) {
+		intrseq++;
+	}
+	if (intrseq < INTRITEMS) {
+		timeout_add(to, 1);
+	}
+}
+
+static
+void
+ringintrtest(void)
+{
+	struct timeout to;
+	uint32_t affinity;
+	unsigned next;
+	void *p;
+	int result;
+
+	affinity = thread_getaffinity();
+	result = thread_setaffinity(1U << curcpu->c_number);
+	if (result) {
+		panic("ringbuftest: thread_setaffinity failed: %s\n",
+		      strerror(result));
+	}
+
+	testring = ringbuf_create(RINGSIZE / 8,
+				  RINGBUF_MPMC | RINGBUF_INTR);
+	if (testring == NULL) {
+		panic("ringbuftest: ringbuf_create failed\n");
+	}
+	intrseq = 0;
+	timeout_init(&to, ringintr, &to);
+	timeout_add(&to, 1);
+
+	next = 0;
+	while (next < INTRITEMS) {
+		p = ringbuf_get(testring);
+		if (p == NULL) {
+			thread_yield();
+			continue;
+		}
+		KASSERT(p == ITEM(0, next));
+		next++;
+	}
+	KASSERT(!timeout_pending(&to));
+	ringbuf_destroy(testring);
+	testring = NULL;
+
+	result = thread_setaffinity(affinity);
+	KASSERT(result == 0);
+}
+
+////////////////////////////////////////////////////////////
+// menu commands
+
+static
+unsigned
+ringnthreads(void)
+{
+	unsigned n;
+
+	n = cpu_count();
+	return n > MAXTHREADS ? MAXTHREADS : n;
+}
+
+int
+ringbuftest(int nargs, char **args)
+{
+	unsigned n;
+
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: rb1\n");
+		return EINVAL;
+	}
+
+	ringdone = sem_create("ringdone", 0);
+	if (ringdone == NULL) {
+		panic("ringbuftest: sem_create failed\n");
+	}
+
+	kprintf("Starting ring buffer test...\n");
+	ringbasic(RINGBUF_SPSC);
+	ringbasic(RINGBUF_MPMC);
+	ringbasic(RINGBUF_MPMC | RINGBUF_INTR);
+
+	n = ringnthreads();
+	(void)ringrun(RINGBUF_SPSC, 1, 1, ITEMS, 0);
+	(void)ringrun(RINGBUF_MPMC, n, n, ITEMS, 0);
+	(void)ringrun(RINGBUF_MPMC, n, 1, ITEMS / n, 1);
+	(void)ringrun(RINGBUF_MPMC, 1, n, ITEMS, MAXBATCH);
+	ringintrtest();
+	kprintf("Ring buffer test done.\n");
+
+	sem_destroy(ringdone);
+	return 0;
+}
+
+int
+ringbufbench(int nargs, char **args)
+{
+	static const unsigned batches[] = { 1, MAXBATCH };
+	unsigned long msecs;
+	unsigned n, i;
+
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: rb2\n");
+		return EINVAL;
+	}
+
+	ringdone = sem_create("ringdone", 0);
+	if (ringdone == NULL) {
+		panic("ringbufbench: sem_create failed\n");
+	}
+
+	kprintf("Starting ring buffer benchmark...\n");
+	n = ringnthreads();
+	for (i=0; i<sizeof(batches)/sizeof(batches[0]); i++) {
+		msecs = ringrun(RINGBUF_SPSC, 1, 1, BENCHITEMS,
+				batches[i]);
+		kprintf("spsc 1x1   batch %2u: %8lu items/sec\n",
+			batches[i], (unsigned long)BENCHITEMS * 1000 / msecs);
+		msecs = ringrun(RINGBUF_MPMC, 1, 1, BENCHITEMS,
+				batches[i]);
+		kprintf("mpmc 1x1   batch %2u: %8lu items/sec\n",
+			batches[i], (unsigned long)BENCHITEMS * 1000 / msecs);
+		msecs = ringrun(RINGBUF_MPMC, n, n, BENCHITEMS / n,
+				batches[i]);
+		kprintf("mpmc %2ux%-2u batch %2u: %8lu items/sec\n",
+			n, n, batches[i],
+			(unsigned long)(BENCHITEMS / n) * n * 1000 / msecs);
+	}
+	kprintf("Ring buffer benchmark done.\n");
+
+	sem_destroy(ringdone);
+	return 0;
+}
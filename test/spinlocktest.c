@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Spinlock contention benchmark.
+ *
+ * For 1 up to the number of cpus, that many threads hammer on one
+ * spinlock, first a test-and-set one and then an MCS one. We report
+ * acquisitions per second, and the worst-case wait, measured as the
+ * most acquisitions by other cpus that got in ahead of a cpu while
+ * it was waiting. (With a fair lock that's at most one per other
+ * waiter.)
+ *
+ * Each thread sets its affinity to a cpu of its own, so they're
+ * spread out from the start.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <test.h>
+
+#define SPINLOOPS   20000
+#define OUTSIDEWORK 20		/* Loop iterations outside the lock */
+
+static struct spinlock benchlock;
+static struct semaphore *benchdone;
+static volatile bool benchgo;
+static volatile unsigned benchacquires;
+static volatile unsigned benchmaxwait;
+
+static
+void
+spinbenchthread(void *junk, unsigned long num)
+{
+	unsigned before, waited;
+	volatile int j;
+	int i, result;
+
+	(void)junk;
+
+	result = thread_setaffinity(1U << num);
+	if (result) {
+		panic("spinbench: thread_setaffinity failed: %s\n",
+		      strerror(result));
+	}
+
+	while (!benchgo) {
+		thread_yield();
+	}
+
+	for (i=0; i<SPINLOOPS; i++) {
+		before = benchacquires;
+		spinlock_acquire(&benchlock);
+		waited = benchacquires - before;
+		if (waited > benchmaxwait) {
+			benchmaxwait = waited;
+		}
+		benchacquires++;
+		spinlock_release(&benchlock);
+
+		for (j=0; j<OUTSIDEWORK; j++);
+	}
+	V(benchdone);
+}
+
+static
+void
+spinbench(bool mcs, unsigned nthreads)
+{
+	time_t beforesecs, aftersecs, secs;
+	uint32_t beforensecs, afternsecs, nsecs;
+	unsigned long msecs;
+	char name[16];
+	unsigned i;
+	int result;
+
+	if (mcs) {
+		spinlock_init_mcs(&benchlock);
+	}
+	else {
+		spinlock_init(&benchlock);
+	}
+	benchgo = false;
+	benchacquires = 0;
+	benchmaxwait = 0;
+
+	for (i=0; i<nthreads; i++) {
+		snprintf(name, sizeof(name), "spinbench%u", i);
+		result = thread_fork(name, NULL, spinbenchthread, NULL, i);
+		if (result) {
+			panic("spinbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	gettime(&beforesecs, &beforensecs);
+	benchgo = true;
+	for (i=0; i<nthreads; i++) {
+		P(benchdone);
+	}
+	gettime(&aftersecs, &afternsecs);
+	getinterval(beforesecs, beforensecs, aftersecs, afternsecs,
+		    &secs, &nsecs);
+	msecs = (unsigned long)secs * 1000 + nsecs / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+
+	KASSERT(benchacquires == nthreads * SPINLOOPS);
+	spinlock_cleanup(&benchlock);
+
+	kprintf("%-4s %2u cpus: %8lu acquires/sec, worst wait %u\n",
+		mcs ? "mcs" : "tas", nthreads,
+		(unsigned long)benchacquires * 1000 / msecs, benchmaxwait);
+}
+
+int
+spinlockbench(int nargs, char **args)
+{
+	unsigned ncpus, n;
+
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: sp1\n");
+		return EINVAL;
+	}
+
+	benchdone = sem_create("spinbench", 0);
+	if (benchdone == NULL) {
+		panic("spinlockbench: sem_create failed\n");
+	}
+
+	kprintf("Starting spinlock contention benchmark...\n");
+	ncpus = cpu_count();
+	for (n=1; n<=ncpus; n++) {
+		spinbench(false, n);
+		spinbench(true, n);
+	}
+	kprintf("Spinlock contention benchmark done.\n");
+
+	sem_destroy(benchdone);
+	return 0;
+}
@@ -32,15 +32,19 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
+#include <spinlock.h>
 #include <synch.h>
 #include <test.h>
 
 #define NSEMLOOPS     63
 #define NLOCKLOOPS    120
 #define NCVLOOPS      5
+#define NRWLOOPS      200
+#define RWWRITEFREQ   8		/* One in this many passes writes */
 #define NTHREADS      32
 
 static volatile unsigned long testval1;
@@ -347,3 +351,623 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Reader-writer lock test. Writers update the test values and
+ * readers check they're consistent, as in the lock test, and both
+ * check that nobody else is writing. We also keep track of how many
+ * readers got in at once, to show that they do share.
+ */
+static struct rwlock *testrwlock;
+static struct spinlock rwstatlock;
+static volatile unsigned rwreaders, rwmaxreaders;
+static volatile bool rwwriting;
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: Mismatch on %s\n", num, msg);
+	kprintf("Test failed\n");
+
+	rwlock_release(testrwlock);
+
+	V(donesem);
+	thread_exit();
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	int i;
+	volatile int j;
+	unsigned long v;
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (random() % RWWRITEFREQ == 0) {
+			rwlock_acquire_write(testrwlock);
+			if (rwwriting || rwreaders > 0) {
+				rwfail(num, "writer exclusion");
+			}
+			rwwriting = true;
+			testval1 = num;
+			thread_yield();
+			testval2 = num*num;
+			testval3 = num%3;
+			rwwriting = false;
+			rwlock_release(testrwlock);
+			continue;
+		}
+
+		rwlock_acquire_read(testrwlock);
+		spinlock_acquire(&rwstatlock);
+		rwreaders++;
+		if (rwreaders > rwmaxreaders) {
+			rwmaxreaders = rwreaders;
+		}
+		spinlock_release(&rwstatlock);
+
+		if (rwwriting) {
+			rwfail(num, "reader exclusion");
+		}
+		v = testval1;
+		/* Linger so other readers can get in. */
+		for (j=0; j<500; j++);
+		if (testval2 != v*v) {
+			rwfail(num, "testval2/testval1");
+		}
+		if (testval3 != v%3) {
+			rwfail(num, "testval3/testval1");
+		}
+
+		spinlock_acquire(&rwstatlock);
+		rwreaders--;
+		spinlock_release(&rwstatlock);
+		rwlock_release(testrwlock);
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting rwlock test...\n");
+
+	testrwlock = rwlock_create("testrwlock");
+	if (testrwlock == NULL) {
+		panic("rwtest: rwlock_create failed\n");
+	}
+	spinlock_init(&rwstatlock);
+	rwreaders = rwmaxreaders = 0;
+	rwwriting = false;
+	testval1 = testval2 = testval3 = 0;
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, rwtestthread,
+				     NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	rwlock_destroy(testrwlock);
+	testrwlock = NULL;
+	spinlock_cleanup(&rwstatlock);
+
+#ifdef UW
+  cleanitems();
+#endif
+	kprintf("Up to %u readers held the lock at once\n", rwmaxreaders);
+	kprintf("RW lock test done.\n");
+
+	return 0;
+}
+
+/*
+ * CV broadcast benchmark. Like processes in waitpid, NTHREADS threads
+ * sleep on a CV until a flag changes; then one broadcast releases
+ * them all, and each briefly holds the lock to collect its result.
+ * Timed from the broadcast until every waiter is through, once with
+ * wait morphing and once without, so the cost of the thundering herd
+ * shows up in the difference.
+ */
+
+#define NBCASTROUNDS  50
+#define BCASTWORK     200	/* Loop iterations done holding the lock */
+
+static struct lock *bcastlock;
+static struct cv *bcastcv;
+static struct semaphore *bcastdone;
+static volatile unsigned bcastgen;
+static volatile unsigned bcastwaiting;
+
+static
+void
+bcastthread(void *junk, unsigned long num)
+{
+	unsigned gen;
+	int i, j;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<NBCASTROUNDS * 2; i++) {
+		lock_acquire(bcastlock);
+		gen = bcastgen;
+		bcastwaiting++;
+		while (bcastgen == gen) {
+			cv_wait(bcastcv, bcastlock);
+		}
+		for (j=0; j<BCASTWORK; j++) {
+			testval1 = j;
+		}
+		lock_release(bcastlock);
+		V(bcastdone);
+	}
+}
+
+static
+uint64_t
+bcastround(void)
+{
+	uint64_t start;
+	unsigned waiting;
+	int i;
+
+	/* Wait until everyone is on the CV. */
+	do {
+		lock_acquire(bcastlock);
+		waiting = bcastwaiting;
+		lock_release(bcastlock);
+		if (waiting < NTHREADS) {
+			thread_yield();
+		}
+	} while (waiting < NTHREADS);
+
+	start = getnsecs();
+	lock_acquire(bcastlock);
+	bcastwaiting = 0;
+	bcastgen++;
+	cv_broadcast(bcastcv, bcastlock);
+	lock_release(bcastlock);
+	for (i=0; i<NTHREADS; i++) {
+		P(bcastdone);
+	}
+	return getnsecs() - start;
+}
+
+int
+cvbroadcastbench(int nargs, char **args)
+{
+	uint64_t total;
+	bool oldmorphing;
+	int i, pass, result;
+
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: sy5\n");
+		return EINVAL;
+	}
+
+	bcastlock = lock_create("bcastlock");
+	bcastcv = cv_create("bcastcv");
+	bcastdone = sem_create("bcastdone", 0);
+	if (bcastlock == NULL || bcastcv == NULL || bcastdone == NULL) {
+		panic("cvbroadcastbench: out of memory\n");
+	}
+	bcastgen = 0;
+	bcastwaiting = 0;
+
+	kprintf("Starting CV broadcast benchmark...\n");
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, bcastthread, NULL, i);
+		if (result) {
+			panic("cvbroadcastbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	oldmorphing = cv_wait_morphing;
+	for (pass=0; pass<2; pass++) {
+		cv_wait_morphing = (pass == 1);
+		total = 0;
+		for (i=0; i<NBCASTROUNDS; i++) {
+			total += bcastround();
+		}
+		kprintf("%-8s %d waiters: %llu us per broadcast\n",
+			cv_wait_morphing ? "morphing" : "wakeall", NTHREADS,
+			(unsigned long long)(total / NBCASTROUNDS / 1000));
+	}
+	cv_wait_morphing = oldmorphing;
+
+	/* The threads are done once their last V is in. */
+	sem_destroy(bcastdone);
+	cv_destroy(bcastcv);
+	lock_destroy(bcastlock);
+	bcastdone = NULL;
+	bcastcv = NULL;
+	bcastlock = NULL;
+
+	kprintf("CV broadcast benchmark done.\n");
+
+	return 0;
+}
+
+/*
+ * Fairness benchmark. NTHREADS threads take a lock (or a semaphore
+ * used as a mutex) over and over for FAIRSECS seconds, doing a little
+ * work inside and outside. Reports how evenly the acquisitions were
+ * spread over the threads (min, max, and Jain's fairness index, where
+ * 100 is perfectly even) and the longest any one acquisition waited,
+ * with and without synch_handoff.
+ */
+
+#define FAIRSECS      2
+#define FAIRWORK      100	/* Loop iterations inside and outside */
+
+static struct lock *fairlock;
+static struct semaphore *fairsem;
+static struct semaphore *fairdone;
+static volatile bool fairstop;
+static unsigned fairacquired[NTHREADS];
+static uint64_t fairmaxwait[NTHREADS];
+
+static
+void
+fairthread(void *junk, unsigned long num)
+{
+	bool usesem = junk != NULL;
+	uint64_t start, wait;
+	int i;
+
+	while (!fairstop) {
+		start = getnsecs();
+		if (usesem) {
+			P(fairsem);
+		}
+		else {
+			lock_acquire(fairlock);
+		}
+		wait = getnsecs() - start;
+		for (i=0; i<FAIRWORK; i++) {
+			testval1 = i;
+		}
+		if (usesem) {
+			V(fairsem);
+		}
+		else {
+			lock_release(fairlock);
+		}
+
+		fairacquired[num]++;
+		if (wait > fairmaxwait[num]) {
+			fairmaxwait[num] = wait;
+		}
+		for (i=0; i<FAIRWORK; i++) {
+			testval2 = i;
+		}
+	}
+	V(fairdone);
+}
+
+static
+void
+fairrun(bool usesem)
+{
+	unsigned min, max;
+	uint64_t sum, sumsq, maxwait;
+	int i, result;
+
+	for (i=0; i<NTHREADS; i++) {
+		fairacquired[i] = 0;
+		fairmaxwait[i] = 0;
+	}
+	fairstop = false;
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, fairthread,
+				     usesem ? fairsem : NULL, i);
+		if (result) {
+			panic("fairbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	clocksleep(FAIRSECS);
+	fairstop = true;
+	for (i=0; i<NTHREADS; i++) {
+		P(fairdone);
+	}
+
+	min = max = fairacquired[0];
+	sum = sumsq = maxwait = 0;
+	for (i=0; i<NTHREADS; i++) {
+		if (fairacquired[i] < min) {
+			min = fairacquired[i];
+		}
+		if (fairacquired[i] > max) {
+			max = fairacquired[i];
+		}
+		if (fairmaxwait[i] > maxwait) {
+			maxwait = fairmaxwait[i];
+		}
+		sum += fairacquired[i];
+		sumsq += (uint64_t)fairacquired[i] * fairacquired[i];
+	}
+
+	kprintf("%-4s %-7s: %llu acquisitions, per thread %u-%u, "
+		"fairness %llu, max wait %llu us\n",
+		usesem ? "sem" : "lock", synch_handoff ? "handoff" : "barging",
+		(unsigned long long)sum, min, max,
+		(unsigned long long)(sumsq ? sum * sum * 100 /
+				     (sumsq * NTHREADS) : 0),
+		(unsigned long long)(maxwait / 1000));
+}
+
+int
+fairbench(int nargs, char **args)
+{
+	bool oldhandoff;
+
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: sy6\n");
+		return EINVAL;
+	}
+
+	fairlock = lock_create("fairlock");
+	fairsem = sem_create("fairsem", 1);
+	fairdone = sem_create("fairdone", 0);
+	if (fairlock == NULL || fairsem == NULL || fairdone == NULL) {
+		panic("fairbench: out of memory\n");
+	}
+
+	kprintf("Starting lock fairness benchmark...\n");
+	oldhandoff = synch_handoff;
+	synch_handoff = false;
+	fairrun(false);
+	fairrun(true);
+	synch_handoff = true;
+	fairrun(false);
+	fairrun(true);
+	synch_handoff = oldhandoff;
+
+	sem_destroy(fairdone);
+	sem_destroy(fairsem);
+	lock_destroy(fairlock);
+	fairdone = NULL;
+	fairsem = NULL;
+	fairlock = NULL;
+
+	kprintf("Lock fairness benchmark done.\n");
+
+	return 0;
+}
+
+/*
+ * Priority inversion test. A low-priority thread takes a lock and
+ * works for a while holding it; a high-priority thread then wants
+ * the lock, while medium-priority threads keep the cpu busy. All of
+ * them are on the same cpu. Without priority inheritance the low
+ * thread can't run until the medium ones are done, and the high one
+ * waits for all of them; with it, the high one waits only for the
+ * low one's work. Run both ways.
+ */
+
+#define PI_NMEDIUM    3
+#define PI_LOWWORK    20000000	/* ns the low thread holds the lock */
+#define PI_MEDWORK    500000000	/* ns the medium threads spin */
+#define PI_HIGHDELAY  50000000	/* ns before the high thread starts */
+
+static struct lock *pilock;
+static struct semaphore *pisem;
+static volatile uint64_t piwait;
+
+static
+void
+pispin(uint64_t nsecs)
+{
+	uint64_t end = getnsecs() + nsecs;
+
+	while (getnsecs() < end) {
+		/* spin */
+	}
+}
+
+static
+void
+pithread(void *junk, unsigned long pri)
+{
+	uint64_t start;
+	int result;
+
+	(void)junk;
+
+	result = thread_setaffinity(1U << 0);
+	KASSERT(result == 0);
+	thread_setpriority(pri);
+
+	switch (pri) {
+	    case THREAD_PRI_MIN:
+		lock_acquire(pilock);
+		V(pisem);
+		pispin(PI_LOWWORK);
+		lock_release(pilock);
+		break;
+	    case THREAD_PRI_DEFAULT:
+		pispin(PI_MEDWORK);
+		break;
+	    case THREAD_PRI_MAX:
+		thread_sleep_ns(PI_HIGHDELAY);
+		start = getnsecs();
+		lock_acquire(pilock);
+		piwait = getnsecs() - start;
+		lock_release(pilock);
+		break;
+	    default:
+		panic("pithread: bad priority %lu\n", pri);
+	}
+	V(pisem);
+}
+
+static
+uint64_t
+pirun(void)
+{
+	int i, result;
+
+	result = thread_fork("pi-low", NULL, pithread, NULL,
+			     THREAD_PRI_MIN);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+	/* Wait until it has the lock. */
+	P(pisem);
+
+	result = thread_fork("pi-high", NULL, pithread, NULL,
+			     THREAD_PRI_MAX);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+	for (i=0; i<PI_NMEDIUM; i++) {
+		result = thread_fork("pi-medium", NULL, pithread, NULL,
+				     THREAD_PRI_DEFAULT);
+		if (result) {
+			panic("pitest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	for (i=0; i<PI_NMEDIUM + 2; i++) {
+		P(pisem);
+	}
+	return piwait;
+}
+
+int
+pitest(int nargs, char **args)
+{
+	uint64_t without, with;
+	bool oldpi;
+	int oldpri;
+
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: sy7\n");
+		return EINVAL;
+	}
+
+	pilock = lock_create("pilock");
+	pisem = sem_create("pisem", 0);
+	if (pilock == NULL || pisem == NULL) {
+		panic("pitest: out of memory\n");
+	}
+
+	/*
+	 * Run above the medium threads, so that if we share their
+	 * cpu we can still get on to start the others.
+	 */
+	oldpri = thread_getpriority();
+	thread_setpriority(THREAD_PRI_MAX);
+
+	kprintf("Starting priority inversion test...\n");
+	oldpi = lock_priority_inheritance;
+	lock_priority_inheritance = false;
+	without = pirun();
+	lock_priority_inheritance = true;
+	with = pirun();
+	lock_priority_inheritance = oldpi;
+
+	thread_setpriority(oldpri);
+
+	kprintf("High-priority thread waited %llu ms without inheritance, "
+		"%llu ms with\n", (unsigned long long)(without / 1000000),
+		(unsigned long long)(with / 1000000));
+	if (with >= PI_MEDWORK) {
+		kprintf("pitest: FAILED: still blocked behind "
+			"medium-priority work\n");
+	}
+
+	sem_destroy(pisem);
+	lock_destroy(pilock);
+	pisem = NULL;
+	pilock = NULL;
+
+	kprintf("Priority inversion test done.\n");
+
+	return 0;
+}
+
+/*
+ * Lock spinning benchmark. Runs the lock test's threads with spinning
+ * off and then with spinning on, and prints the context switch counts
+ * and elapsed time for each (see thread_printstats), so the two can
+ * be compared on the same kernel.
+ */
+static
+void
+spinrun(unsigned budget)
+{
+	int i, result;
+
+	lock_spin_budget = budget;
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, locktestthread,
+				     NULL, i);
+		if (result) {
+			panic("lockspinbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	kprintf("Spin budget %u: ", budget);
+	thread_printstats();
+}
+
+int
+lockspinbench(int nargs, char **args)
+{
+	unsigned oldbudget;
+
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: sy8\n");
+		return EINVAL;
+	}
+
+	inititems();
+	kprintf("Starting lock spin benchmark...\n");
+
+	/* Printing the counters resets them, so each run reports just itself. */
+	thread_printstats();
+
+	oldbudget = lock_spin_budget;
+	spinrun(0);
+	spinrun(oldbudget > 0 ? oldbudget : LOCK_SPIN_DEFAULT);
+	lock_spin_budget = oldbudget;
+
+	kprintf("Lock spin benchmark done.\n");
+
+	return 0;
+}
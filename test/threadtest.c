@@ -31,14 +31,28 @@
  * Thread test code.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
+#include <cpu.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
 
 #define NTHREADS  8
 
+/* Work per thread for the throughput benchmark. */
+#define BENCHLOOPS  400000
+
+/* Threads created for the create/exit benchmark. */
+#define FORKLOOPS   2000
+
+/* Round trips for the wakeup benchmark. */
+#define PINGPONGS   5000
+
 static struct semaphore *tsem = NULL;
+static struct semaphore *pingsem = NULL;
+static struct semaphore *pongsem = NULL;
 
 static
 void
@@ -144,3 +158,268 @@ threadtest2(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Scheduler throughput benchmark.
+ *
+ * Runs a batch of CPU-bound threads (like those in tt2, but quiet)
+ * once under each load balancing policy and reports the wall-clock
+ * time each batch took. Run it on kernels configured with different
+ * numbers of cpus in sys161.conf to see how the policies scale.
+ */
+static
+void
+computethread(void *junk, unsigned long num)
+{
+	volatile int i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<BENCHLOOPS; i++);
+
+	V(tsem);
+}
+
+static
+void
+benchthreads(int policy, const char *policyname, int nthreads)
+{
+	time_t beforesecs, aftersecs, secs;
+	uint32_t beforensecs, afternsecs, nsecs;
+	char name[16];
+	int i, result;
+
+	thread_balance_policy = policy;
+
+	gettime(&beforesecs, &beforensecs);
+	for (i=0; i<nthreads; i++) {
+		snprintf(name, sizeof(name), "threadbench%d", i);
+		result = thread_fork(name, NULL, computethread, NULL, i);
+		if (result) {
+			panic("threadbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(tsem);
+	}
+	gettime(&aftersecs, &afternsecs);
+	getinterval(beforesecs, beforensecs, aftersecs, afternsecs,
+		    &secs, &nsecs);
+
+	kprintf("%-6s %d threads: %lu.%09lu seconds\n", policyname, nthreads,
+		(unsigned long) secs, (unsigned long) nsecs);
+}
+
+int
+threadbench(int nargs, char **args)
+{
+	int nthreads, oldpolicy;
+
+	if (nargs == 1) {
+		nthreads = NTHREADS;
+	}
+	else if (nargs == 2) {
+		nthreads = atoi(args[1]);
+	}
+	else {
+		kprintf("Usage: tt4 [threads]\n");
+		return EINVAL;
+	}
+
+	init_sem();
+	kprintf("Starting scheduler throughput benchmark...\n");
+
+	oldpolicy = thread_balance_policy;
+	benchthreads(THREAD_BALANCE_PUSH, "push", nthreads);
+	benchthreads(THREAD_BALANCE_STEAL, "steal", nthreads);
+	thread_balance_policy = oldpolicy;
+
+	kprintf("Scheduler throughput benchmark done.\n");
+
+	return 0;
+}
+
+/*
+ * Thread create/exit benchmark: fork a thread that does nothing and
+ * wait for it, over and over, with and without the thread cache.
+ */
+
+static
+void
+nullthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	V(tsem);
+}
+
+static
+void
+benchforks(const char *cachename)
+{
+	time_t beforesecs, aftersecs, secs;
+	uint32_t beforensecs, afternsecs, nsecs;
+	unsigned long usecs;
+	int i, result;
+
+	gettime(&beforesecs, &beforensecs);
+	for (i=0; i<FORKLOOPS; i++) {
+		result = thread_fork("forkbench", NULL, nullthread, NULL, i);
+		if (result) {
+			panic("forkbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+		P(tsem);
+	}
+	gettime(&aftersecs, &afternsecs);
+	getinterval(beforesecs, beforensecs, aftersecs, afternsecs,
+		    &secs, &nsecs);
+	usecs = (unsigned long)secs * 1000000 + nsecs / 1000;
+
+	kprintf("%-8s %d threads: %lu.%06lu seconds, %lu us each\n",
+		cachename, FORKLOOPS, usecs / 1000000, usecs % 1000000,
+		usecs / FORKLOOPS);
+}
+
+int
+forkbench(int nargs, char **args)
+{
+	unsigned oldmax;
+
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: tt5\n");
+		return EINVAL;
+	}
+
+	init_sem();
+	kprintf("Starting thread create/exit benchmark...\n");
+
+	/*
+	 * With the cache off, whatever is already cached gets used
+	 * up within the first few forks, and nothing new is cached.
+	 */
+	oldmax = thread_cache_max;
+	thread_cache_max = 0;
+	benchforks("uncached");
+	thread_cache_max = THREAD_CACHE_DEFAULT;
+	benchforks("cached");
+	thread_cache_max = oldmax;
+
+	kprintf("Thread create/exit benchmark done.\n");
+
+	return 0;
+}
+
+/*
+ * Cross-cpu wakeup benchmark: two threads on different cpus bounce a
+ * pair of semaphores back and forth, so every V wakes a thread on the
+ * other cpu. Run once with remote wakeups going through the wakeup
+ * queues, and once with the waker taking the other cpu's run queue
+ * lock.
+ */
+
+static
+void
+pongthread(void *junk, unsigned long num)
+{
+	int i, result;
+
+	(void)junk;
+
+	result = thread_setaffinity(1U << num);
+	if (result) {
+		panic("pingpongbench: thread_setaffinity failed: %s\n",
+		      strerror(result));
+	}
+
+	for (i=0; i<PINGPONGS; i++) {
+		P(pingsem);
+		V(pongsem);
+	}
+	V(tsem);
+}
+
+static
+void
+benchpingpong(bool wakeq)
+{
+	time_t beforesecs, aftersecs, secs;
+	uint32_t beforensecs, afternsecs, nsecs;
+	unsigned long usecs;
+	int i, result;
+
+	thread_remote_wakeq = wakeq;
+
+	result = thread_fork("pingpong", NULL, pongthread, NULL, 1);
+	if (result) {
+		panic("pingpongbench: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+
+	gettime(&beforesecs, &beforensecs);
+	for (i=0; i<PINGPONGS; i++) {
+		V(pingsem);
+		P(pongsem);
+	}
+	gettime(&aftersecs, &afternsecs);
+	P(tsem);
+
+	getinterval(beforesecs, beforensecs, aftersecs, afternsecs,
+		    &secs, &nsecs);
+	usecs = (unsigned long)secs * 1000000 + nsecs / 1000;
+
+	kprintf("%-6s %d round trips: %lu.%06lu seconds, %lu us each\n",
+		wakeq ? "wakeq" : "locked", PINGPONGS,
+		usecs / 1000000, usecs % 1000000, usecs / PINGPONGS);
+}
+
+int
+pingpongbench(int nargs, char **args)
+{
+	uint32_t oldaffinity;
+	bool oldwakeq;
+	int result;
+
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: tt6\n");
+		return EINVAL;
+	}
+	if (cpu_count() < 2) {
+		kprintf("tt6: needs at least 2 cpus\n");
+		return 0;
+	}
+
+	init_sem();
+	if (pingsem == NULL) {
+		pingsem = sem_create("pingsem", 0);
+		pongsem = sem_create("pongsem", 0);
+		if (pingsem == NULL || pongsem == NULL) {
+			panic("pingpongbench: sem_create failed\n");
+		}
+	}
+	kprintf("Starting cross-cpu wakeup benchmark...\n");
+
+	/* We run on cpu 0; the other thread pins itself to cpu 1. */
+	oldaffinity = thread_getaffinity();
+	result = thread_setaffinity(1U << 0);
+	KASSERT(result == 0);
+
+	oldwakeq = thread_remote_wakeq;
+	benchpingpong(false);
+	benchpingpong(true);
+	thread_remote_wakeq = oldwakeq;
+
+	result = thread_setaffinity(oldaffinity);
+	KASSERT(result == 0);
+
+	kprintf("Cross-cpu wakeup benchmark done.\n");
+
+	return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Timeout and timed sleep test.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <test.h>
+
+/*
+ * Delays (in hardclocks), chosen to land on every level of the
+ * wheel and on both sides of the cascade boundaries. In increasing
+ * order, since that's the order they should fire in.
+ */
+static const unsigned delays[] = { 1, 2, 5, 63, 64, 65, 127, 130, 300 };
+#define NDELAYS (sizeof(delays) / sizeof(delays[0]))
+
+/*
+ * One timeout for each delay from 64 to 127 ticks. All of them start
+ * out on level 1, and since one of every 64 ticks is a cascade
+ * boundary, exactly one is due on the very tick it's cascaded.
+ */
+#define NBOUNDARY 64
+
+#define SLEEP_NS 100000000	/* 100 ms */
+
+static volatile unsigned firecount;
+static volatile unsigned fireorder[NDELAYS];
+
+static volatile unsigned boundarycount;
+
+/*
+ * Timeouts all run on the cpu they were added on, and the test
+ * thread is pinned to one cpu, so firecount doesn't need a lock.
+ */
+static
+void
+tmo_fire(void *data)
+{
+	unsigned *which = data;
+
+	fireorder[*which] = firecount++;
+}
+
+static
+void
+tmo_boundary(void *data)
+{
+	(void)data;
+	boundarycount++;
+}
+
+int
+timeouttest(int nargs, char **args)
+{
+	struct timeout tos[NDELAYS], cto, btos[NBOUNDARY];
+	unsigned which[NDELAYS], i;
+	uint32_t affinity;
+	time_t s1, s2, ds;
+	uint32_t ns1, ns2, dns;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting timeout test...\n");
+
+	/* Keep all the timeouts on one cpu's wheel. */
+	affinity = thread_getaffinity();
+	result = thread_setaffinity(1U << curcpu->c_number);
+	if (result) {
+		panic("timeouttest: thread_setaffinity failed: %s\n",
+		      strerror(result));
+	}
+
+	firecount = 0;
+	for (i=0; i<NDELAYS; i++) {
+		which[i] = i;
+		fireorder[i] = NDELAYS;
+		timeout_init(&tos[i], tmo_fire, &which[i]);
+	}
+	/* Add them backwards so insertion order can't help. */
+	for (i=NDELAYS; i-- > 0; ) {
+		timeout_add(&tos[i], delays[i]);
+		KASSERT(timeout_pending(&tos[i]));
+	}
+
+	/* This one should never fire. */
+	timeout_init(&cto, tmo_fire, NULL);
+	timeout_add(&cto, 50);
+	KASSERT(timeout_cancel(&cto));
+	KASSERT(!timeout_pending(&cto));
+	KASSERT(!timeout_cancel(&cto));
+
+	thread_sleep_ticks(delays[NDELAYS-1] + 2);
+
+	if (firecount != NDELAYS) {
+		panic("timeouttest: %u of %u timeouts fired\n",
+		      firecount, (unsigned)NDELAYS);
+	}
+	for (i=0; i<NDELAYS; i++) {
+		KASSERT(!timeout_pending(&tos[i]));
+		if (fireorder[i] != i) {
+			panic("timeouttest: %u-tick timeout fired %uth\n",
+			      delays[i], fireorder[i]);
+		}
+	}
+	kprintf("Timeouts fired in order.\n");
+
+	boundarycount = 0;
+	for (i=0; i<NBOUNDARY; i++) {
+		timeout_init(&btos[i], tmo_boundary, NULL);
+		timeout_add(&btos[i], NBOUNDARY + i);
+	}
+	thread_sleep_ticks(2 * NBOUNDARY + 1);
+	if (boundarycount != NBOUNDARY) {
+		panic("timeouttest: %u of %u cascaded timeouts fired\n",
+		      boundarycount, (unsigned)NBOUNDARY);
+	}
+	for (i=0; i<NBOUNDARY; i++) {
+		KASSERT(!timeout_pending(&btos[i]));
+	}
+	kprintf("Cascaded timeouts fired.\n");
+
+	gettime(&s1, &ns1);
+	thread_sleep_ns(SLEEP_NS);
+	gettime(&s2, &ns2);
+	getinterval(s1, ns1, s2, ns2, &ds, &dns);
+	if (ds == 0 && dns < SLEEP_NS) {
+		panic("timeouttest: slept only %u ns\n", dns);
+	}
+	kprintf("Slept %lu.%09lu seconds for 0.%09lu\n",
+		(unsigned long)ds, (unsigned long)dns,
+		(unsigned long)SLEEP_NS);
+
+	result = thread_setaffinity(affinity);
+	if (result) {
+		panic("timeouttest: thread_setaffinity failed: %s\n",
+		      strerror(result));
+	}
+
+	kprintf("Timeout test done.\n");
+	return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Workqueue test.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <cpu.h>
+#include <synch.h>
+#include <current.h>
+#include <workqueue.h>
+#include <test.h>
+
+#define WORKPERCPU 16
+#define WORKDELAY  5		/* hardclocks */
+
+static struct semaphore *workdone;
+static struct spinlock workstatlock;
+static volatile unsigned workwrongcpu;
+
+/*
+ * Work function; the argument is the cpu it should be running on.
+ */
+static
+void
+testwork(void *data)
+{
+	struct cpu *c = data;
+
+	if (curcpu->c_self != c) {
+		spinlock_acquire(&workstatlock);
+		workwrongcpu++;
+		spinlock_release(&workstatlock);
+	}
+	V(workdone);
+}
+
+/*
+ * Timeout callback, to check work can be queued from interrupts.
+ */
+static
+void
+queuefromtimeout(void *data)
+{
+	int result;
+
+	result = work_queue(data, testwork, data);
+	if (result) {
+		panic("workqueuetest: work_queue from interrupt: %s\n",
+		      strerror(result));
+	}
+}
+
+int
+workqueuetest(int nargs, char **args)
+{
+	struct timeout to;
+	struct cpu *c;
+	unsigned i, j, total;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting workqueue test...\n");
+
+	workdone = sem_create("workdone", 0);
+	if (workdone == NULL) {
+		panic("workqueuetest: sem_create failed\n");
+	}
+	spinlock_init(&workstatlock);
+	workwrongcpu = 0;
+
+	total = 0;
+	for (i=0; i<cpu_count(); i++) {
+		c = cpu_get(i);
+		for (j=0; j<WORKPERCPU; j++) {
+			if (j % 2 == 0) {
+				result = work_queue(c, testwork, c);
+			}
+			else {
+				result = work_queue_delayed(c, testwork, c,
+							    WORKDELAY);
+			}
+			if (result) {
+				panic("workqueuetest: work_queue: %s\n",
+				      strerror(result));
+			}
+			total++;
+		}
+	}
+	for (i=0; i<total; i++) {
+		P(workdone);
+	}
+
+	c = curcpu->c_self;
+	timeout_init(&to, queuefromtimeout, c);
+	timeout_add(&to, 1);
+	P(workdone);
+
+	sem_destroy(workdone);
+	spinlock_cleanup(&workstatlock);
+
+	if (workwrongcpu > 0) {
+		panic("workqueuetest: %u items ran on the wrong cpu\n",
+		      workwrongcpu);
+	}
+	workqueue_printstats();
+	kprintf("Workqueue test done.\n");
+	return 0;
+}
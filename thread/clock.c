@@ -29,11 +29,15 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
 #include <cpu.h>
 #include <wchan.h>
 #include <clock.h>
 #include <thread.h>
+#include <mainbus.h>
 #include <current.h>
+#include <epoch.h>
 
 /*
  * Time handling.
@@ -58,16 +62,339 @@
  */
 static struct wchan *lbolt;
 
+/*
+ * Threads in thread_sleep_ticks() wait on one of these, picked by
+ * hashing the thread pointer, so sleepers don't all stampede on one
+ * channel.
+ */
+#define NSLEEPCHANS 16
+static struct wchan *sleepchans[NSLEEPCHANS];
+
 /*
  * Setup.
  */
 void
 hardclock_bootstrap(void)
 {
+	char name[16];
+	unsigned i;
+
 	lbolt = wchan_create("lbolt");
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+	for (i=0; i<NSLEEPCHANS; i++) {
+		snprintf(name, sizeof(name), "sleep%u", i);
+		sleepchans[i] = wchan_create(name);
+		if (sleepchans[i] == NULL) {
+			panic("Couldn't create %s\n", name);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// timeouts
+
+/*
+ * Each cpu keeps its pending timeouts in a hierarchical timing wheel.
+ * Level 0 has one slot per hardclock for the next TW_SLOTS ticks;
+ * each higher level has slots TW_SLOTS times as wide. A timeout is
+ * filed in the lowest level whose span covers its expiry time, and
+ * each time a level's index wraps to 0 the current slot of the next
+ * level up is "cascaded", that is, refiled into the lower levels.
+ * So both adding and firing a timeout are O(1) apart from the
+ * (amortized) cascading.
+ *
+ * tw_ticks is the wheel's notion of the current time. It counts
+ * ticks processed by this wheel, not c_hardclocks, since the wheel
+ * also runs on idle cpus; it's allowed to wrap.
+ */
+#define TW_LEVELS	4
+#define TW_BITS		6
+#define TW_SLOTS	(1U << TW_BITS)
+#define TW_MASK		(TW_SLOTS - 1)
+
+struct timeoutwheel {
+	struct spinlock tw_lock;
+	unsigned tw_ticks;		/* Ticks processed so far */
+	unsigned tw_count;		/* Number of pending timeouts */
+	struct timeout *tw_slots[TW_LEVELS][TW_SLOTS];
+};
+
+struct timeoutwheel *
+timeoutwheel_create(void)
+{
+	struct timeoutwheel *tw;
+	unsigned i, j;
+
+	tw = kmalloc(sizeof(*tw));
+	if (tw == NULL) {
+		return NULL;
+	}
+	spinlock_init(&tw->tw_lock);
+	tw->tw_ticks = 0;
+	tw->tw_count = 0;
+	for (i=0; i<TW_LEVELS; i++) {
+		for (j=0; j<TW_SLOTS; j++) {
+			tw->tw_slots[i][j] = NULL;
+		}
+	}
+	return tw;
+}
+
+/*
+ * Check if there's anything pending. Only a hint unless the wheel
+ * is our own and interrupts are off, since nobody else adds to it.
+ */
+bool
+timeoutwheel_empty(struct timeoutwheel *tw)
+{
+	return tw->tw_count == 0;
+}
+
+/*
+ * File TO in the right slot for its expiry time. Wheel must be
+ * locked.
+ *
+ * A timeout cascaded down on the tick it's due has a delta of 0; it
+ * goes in the current level 0 slot, which the tick runs right after
+ * cascading, so it still fires on time.
+ */
+static
+void
+timeoutwheel_insert(struct timeoutwheel *tw, struct timeout *to)
+{
+	unsigned delta, level, slot;
+	struct timeout **head;
+
+	delta = to->to_expire - tw->tw_ticks;
+	KASSERT(delta <= TIMEOUT_MAXTICKS);
+
+	for (level = 0; level < TW_LEVELS - 1; level++) {
+		if (delta < (TW_SLOTS << (level * TW_BITS))) {
+			break;
+		}
+	}
+	slot = (to->to_expire >> (level * TW_BITS)) & TW_MASK;
+
+	head = &tw->tw_slots[level][slot];
+	to->to_next = *head;
+	if (to->to_next != NULL) {
+		to->to_next->to_pprev = &to->to_next;
+	}
+	to->to_pprev = head;
+	*head = to;
+	to->to_wheel = tw;
+}
+
+/*
+ * Take TO out of its slot. Wheel must be locked.
+ */
+static
+void
+timeoutwheel_unlink(struct timeoutwheel *tw, struct timeout *to)
+{
+	KASSERT(to->to_wheel == tw);
+
+	*to->to_pprev = to->to_next;
+	if (to->to_next != NULL) {
+		to->to_next->to_pprev = to->to_pprev;
+	}
+	to->to_next = NULL;
+	to->to_pprev = NULL;
+	to->to_wheel = NULL;
+}
+
+/*
+ * Refile everything in one slot of a higher level.
+ */
+static
+void
+timeoutwheel_cascade(struct timeoutwheel *tw, unsigned level, unsigned slot)
+{
+	struct timeout *to, *next;
+
+	to = tw->tw_slots[level][slot];
+	tw->tw_slots[level][slot] = NULL;
+	for (; to != NULL; to = next) {
+		next = to->to_next;
+		timeoutwheel_insert(tw, to);
+	}
+}
+
+/*
+ * Advance this cpu's wheel by one tick and run whatever expires.
+ * Called from hardclock, so interrupts are off and we're staying on
+ * this cpu. The lock is dropped around each callback, so callbacks
+ * can add and cancel timeouts; anything they add is at least one
+ * tick out, so it can't land in the slot being emptied.
+ */
+static
+void
+timeoutwheel_tick(struct timeoutwheel *tw)
+{
+	struct timeout *to;
+	unsigned now, level, slot;
+
+	spinlock_acquire(&tw->tw_lock);
+	now = ++tw->tw_ticks;
+
+	if ((now & TW_MASK) == 0) {
+		for (level = 1; level < TW_LEVELS; level++) {
+			slot = (now >> (level * TW_BITS)) & TW_MASK;
+			timeoutwheel_cascade(tw, level, slot);
+			if (slot != 0) {
+				break;
+			}
+		}
+	}
+
+	slot = now & TW_MASK;
+	while ((to = tw->tw_slots[0][slot]) != NULL) {
+		KASSERT(to->to_expire == now);
+		timeoutwheel_unlink(tw, to);
+		tw->tw_count--;
+		spinlock_release(&tw->tw_lock);
+
+		to->to_func(to->to_arg);
+
+		spinlock_acquire(&tw->tw_lock);
+	}
+	spinlock_release(&tw->tw_lock);
+}
+
+void
+timeout_init(struct timeout *to, void (*func)(void *), void *arg)
+{
+	to->to_func = func;
+	to->to_arg = arg;
+	to->to_expire = 0;
+	to->to_wheel = NULL;
+	to->to_next = NULL;
+	to->to_pprev = NULL;
+}
+
+/*
+ * Timeouts go on the current cpu's wheel. Interrupts are turned off
+ * first so we can't be migrated between picking the wheel and
+ * locking it. hardclock won't stop the clock while the wheel is
+ * nonempty, but it may already have stopped it if this cpu is idle
+ * and we're in a device interrupt, so restart it if so.
+ */
+void
+timeout_add(struct timeout *to, unsigned ticks)
+{
+	struct timeoutwheel *tw;
+	int spl;
+
+	KASSERT(ticks > 0);
+	if (ticks > TIMEOUT_MAXTICKS) {
+		ticks = TIMEOUT_MAXTICKS;
+	}
+
+	timeout_cancel(to);
+
+	spl = splhigh();
+	tw = curcpu->c_timeouts;
+	spinlock_acquire(&tw->tw_lock);
+	to->to_expire = tw->tw_ticks + ticks;
+	timeoutwheel_insert(tw, to);
+	tw->tw_count++;
+	spinlock_release(&tw->tw_lock);
+	if (curcpu->c_hardclock_stopped) {
+		curcpu->c_hardclock_stopped = false;
+		mainbus_start_hardclock();
+	}
+	splx(spl);
+}
+
+/*
+ * The timeout may be on another cpu's wheel, and may fire (or be
+ * re-added somewhere else) while we're getting the lock, so check
+ * that it's still where we think once we hold the lock.
+ */
+bool
+timeout_cancel(struct timeout *to)
+{
+	struct timeoutwheel *tw;
+
+	while ((tw = to->to_wheel) != NULL) {
+		spinlock_acquire(&tw->tw_lock);
+		if (to->to_wheel == tw) {
+			timeoutwheel_unlink(tw, to);
+			tw->tw_count--;
+			spinlock_release(&tw->tw_lock);
+			return true;
+		}
+		spinlock_release(&tw->tw_lock);
+	}
+	return false;
+}
+
+bool
+timeout_pending(struct timeout *to)
+{
+	return to->to_wheel != NULL;
+}
+
+////////////////////////////////////////////////////////////
+// timed sleeps
+
+struct timedsleep {
+	struct wchan *ts_wchan;
+	volatile bool ts_done;
+};
+
+/*
+ * Timeout callback for thread_sleep_ticks. The sleeper may return
+ * (and its stack frame go away) as soon as ts_done is set, so don't
+ * touch TS after that.
+ *
+ * wchan_wakeall takes the channel lock, which the sleeper holds from
+ * checking ts_done until it's on the channel, so the wakeup can't
+ * fall in between and get lost.
+ */
+static
+void
+timedsleep_wakeup(void *data)
+{
+	struct timedsleep *ts = data;
+	struct wchan *wc = ts->ts_wchan;
+
+	ts->ts_done = true;
+	wchan_wakeall(wc);
+}
+
+void
+thread_sleep_ticks(unsigned ticks)
+{
+	struct timedsleep ts;
+	struct timeout to;
+	unsigned chunk;
+
+	ts.ts_wchan = sleepchans[((uintptr_t)curthread >> 4) % NSLEEPCHANS];
+
+	while (ticks > 0) {
+		chunk = ticks > TIMEOUT_MAXTICKS ? TIMEOUT_MAXTICKS : ticks;
+		ticks -= chunk;
+
+		ts.ts_done = false;
+		timeout_init(&to, timedsleep_wakeup, &ts);
+
+		wchan_lock(ts.ts_wchan);
+		timeout_add(&to, chunk);
+		while (!ts.ts_done) {
+			wchan_sleep(ts.ts_wchan);
+			wchan_lock(ts.ts_wchan);
+		}
+		wchan_unlock(ts.ts_wchan);
+	}
+}
+
+void
+thread_sleep_ns(uint32_t nsecs)
+{
+	thread_sleep_ticks(DIVROUNDUP(nsecs, NSEC_PER_HARDCLOCK));
 }
 
 /*
@@ -84,22 +411,62 @@ timerclock(void)
 /*
  * This is called HZ times a second (on each processor) by the timer
  * code.
+ *
+ * Pending timeouts are run first, then epoch grace periods are
+ * checked. If the processor is idle there's nothing to preempt, so
+ * unless it still has timeouts or epoch work pending we stop the
+ * timer; thread_switch restarts it once the processor has something
+ * to run. Otherwise the current thread is preempted once its
+ * timeslice runs out, but only if something else is waiting for the
+ * processor and it isn't in an epoch read section. (The run queue
+ * length is peeked at without locking; if we're wrong, thread_switch
+ * sorts it out, or we catch it next time.)
+ *
+ * Under work stealing, load balancing is driven by busy cpus poking
+ * idle ones, which we need to do promptly, so it's done every time.
  */
 void
 hardclock(void)
 {
+	bool epochbusy;
+
 	/*
 	 * Collect statistics here as desired.
 	 */
 
+	timeoutwheel_tick(curcpu->c_timeouts);
+	epochbusy = epoch_hardclock();
+
+	if (curcpu->c_isidle) {
+		if (!timeoutwheel_empty(curcpu->c_timeouts) || epochbusy) {
+			return;
+		}
+		curcpu->c_hardclock_stopped = true;
+		mainbus_stop_hardclock();
+		return;
+	}
+
 	curcpu->c_hardclocks++;
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
+	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0 ||
+	    thread_balance_policy == THREAD_BALANCE_STEAL) {
 		thread_consider_migration();
 	}
-	thread_yield();
+
+	if (curthread->t_ticksleft > 1) {
+		curthread->t_ticksleft--;
+		return;
+	}
+	if (epoch_reading()) {
+		/* Try again next tick. */
+		return;
+	}
+	curthread->t_ticksleft = curthread->t_quantum;
+	if (curcpu->c_runqueue.tl_count > 0) {
+		thread_yield();
+	}
 }
 
 /*
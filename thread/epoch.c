@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Epoch-based deferred reclamation. See epoch.h.
+ *
+ * Each cpu counts the read sections it's in (epoch_nest), and
+ * records the global epoch number as of its last quiescent point
+ * (epoch_seen). A grace period starts by advancing the global epoch,
+ * and is over once every cpu has seen the new epoch, or is idle (it
+ * went through thread_switch to get there) and not reading in an
+ * interrupt handler.
+ * After that nobody can still hold a pointer to anything unlinked
+ * before it started.
+ *
+ * Requests accumulate on epoch_next until a grace period can start;
+ * then they move to epoch_cur, and when it's over to epoch_done, to
+ * be run by the workqueue.
+ *
+ * Grace periods are only completed from hardclock, where no other
+ * locks can be held; thread_switch just records quiescent points. A
+ * cpu keeps its hardclock going while anything is pending, even when
+ * idle, so things don't get stuck if everyone goes idle.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <percpu.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <workqueue.h>
+#include <epoch.h>
+
+/*
+ * A deferred call.
+ */
+struct epochcall {
+	void (*ec_func)(void *);
+	void *ec_arg;
+	struct epochcall *ec_next;
+};
+
+static PERCPU_DEFINE(unsigned, epoch_nest) = 0;
+static PERCPU_DEFINE(uint32_t, epoch_seen) = 0;
+
+static struct spinlock epoch_lock = SPINLOCK_INITIALIZER;
+static volatile uint32_t epoch_global;		/* Current epoch */
+static volatile uint32_t epoch_completed;	/* Last one that's over */
+static bool epoch_wanted;			/* Another one is needed */
+static struct epochcall *epoch_next;		/* Waiting to start */
+static struct epochcall *epoch_cur;		/* Waiting for this one */
+static struct epochcall *epoch_done;		/* Waiting to be run */
+static bool epoch_reclaiming;			/* Work queued to run them */
+
+void
+epoch_enter(void)
+{
+	int spl;
+
+	spl = splhigh();
+	PERCPU_CUR(epoch_nest)++;
+	splx(spl);
+}
+
+void
+epoch_exit(void)
+{
+	int spl;
+
+	spl = splhigh();
+	KASSERT(PERCPU_CUR(epoch_nest) > 0);
+	PERCPU_CUR(epoch_nest)--;
+	splx(spl);
+}
+
+bool
+epoch_reading(void)
+{
+	return PERCPU_CUR(epoch_nest) > 0;
+}
+
+/*
+ * Called by thread_switch: the current cpu is at a quiescent point.
+ */
+void
+epoch_quiescent(void)
+{
+	KASSERT(PERCPU_CUR(epoch_nest) == 0);
+	PERCPU_CUR(epoch_seen) = epoch_global;
+}
+
+/*
+ * Start a grace period, if one is needed and there isn't one going
+ * already. Call with epoch_lock held.
+ */
+static
+void
+epoch_advance(void)
+{
+	KASSERT(spinlock_do_i_hold(&epoch_lock));
+
+	if (epoch_completed != epoch_global) {
+		return;
+	}
+	if (epoch_next == NULL && !epoch_wanted) {
+		return;
+	}
+	KASSERT(epoch_cur == NULL);
+	epoch_cur = epoch_next;
+	epoch_next = NULL;
+	epoch_wanted = false;
+	epoch_global++;
+}
+
+/*
+ * Workqueue function to run completed requests.
+ */
+static
+void
+epoch_reclaim(void *junk)
+{
+	struct epochcall *ec, *next;
+
+	(void)junk;
+
+	spinlock_acquire(&epoch_lock);
+	ec = epoch_done;
+	epoch_done = NULL;
+	epoch_reclaiming = false;
+	spinlock_release(&epoch_lock);
+
+	while (ec != NULL) {
+		next = ec->ec_next;
+		ec->ec_func(ec->ec_arg);
+		kfree(ec);
+		ec = next;
+	}
+}
+
+/*
+ * Called by hardclock. Record a quiescent point unless the interrupt
+ * came in a read section, and end the current grace period if every
+ * cpu has been through one. Returns true if anything's still pending,
+ * so the hardclock should be kept going.
+ */
+bool
+epoch_hardclock(void)
+{
+	struct cpu *c;
+	struct epochcall **ecp;
+	unsigned i;
+	bool pending;
+
+	if (PERCPU_CUR(epoch_nest) == 0) {
+		PERCPU_CUR(epoch_seen) = epoch_global;
+	}
+
+	/* Peek without the lock; if we're wrong we'll get it next tick. */
+	if (epoch_completed == epoch_global && epoch_done == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&epoch_lock);
+	if (epoch_completed != epoch_global) {
+		PERCPU_FOREACH(c, i) {
+			if (c->c_isidle && PERCPU(epoch_nest, c) == 0) {
+				continue;
+			}
+			if (PERCPU(epoch_seen, c) != epoch_global) {
+				break;
+			}
+		}
+		if (i == cpu_count()) {
+			/* Over; put its requests on the end of epoch_done. */
+			for (ecp = &epoch_done; *ecp != NULL;
+			     ecp = &(*ecp)->ec_next);
+			*ecp = epoch_cur;
+			epoch_cur = NULL;
+			epoch_completed = epoch_global;
+			epoch_advance();
+		}
+	}
+	if (epoch_done != NULL && !epoch_reclaiming &&
+	    curcpu->c_workqueue != NULL) {
+		/* If there's no room on the workqueue, retry next tick. */
+		if (work_queue(NULL, epoch_reclaim, NULL) == 0) {
+			epoch_reclaiming = true;
+		}
+	}
+	pending = epoch_completed != epoch_global || epoch_done != NULL;
+	spinlock_release(&epoch_lock);
+
+	return pending;
+}
+
+int
+epoch_call(void (*func)(void *), void *arg)
+{
+	struct epochcall *ec;
+
+	ec = kmalloc(sizeof(*ec));
+	if (ec == NULL) {
+		return ENOMEM;
+	}
+	ec->ec_func = func;
+	ec->ec_arg = arg;
+
+	spinlock_acquire(&epoch_lock);
+	ec->ec_next = epoch_next;
+	epoch_next = ec;
+	epoch_advance();
+	spinlock_release(&epoch_lock);
+	return 0;
+}
+
+int
+defer_free(void *ptr)
+{
+	return epoch_call(kfree, ptr);
+}
+
+/*
+ * Wait for a full grace period: if one's in progress we have to wait
+ * for the next one too, as it may have started before our caller
+ * unlinked whatever it's about to free. Grace periods only end on a
+ * hardclock, so check once a tick.
+ */
+void
+epoch_synchronize(void)
+{
+	uint32_t target;
+
+	KASSERT(!curthread->t_in_interrupt);
+	KASSERT(PERCPU_CUR(epoch_nest) == 0);
+
+	spinlock_acquire(&epoch_lock);
+	epoch_wanted = true;
+	if (epoch_completed == epoch_global) {
+		epoch_advance();
+		target = epoch_global;
+	}
+	else {
+		target = epoch_global + 1;
+	}
+	spinlock_release(&epoch_lock);
+
+	while ((int32_t)(epoch_completed - target) < 0) {
+		thread_sleep_ticks(1);
+	}
+}
@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Futexes. See futex.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <current.h>
+#include <vm.h>
+#include <wchan.h>
+#include <futex.h>
+#include <syscall.h>
+
+#define FUTEX_HASHSIZE 64	/* Buckets; power of 2 */
+
+/*
+ * A sleeping thread, on its own stack. fw_woken is set (and the
+ * waiter unlinked) by futex_wake, under the bucket lock. The waiter
+ * sleeps in the SQ_FUTEX sleep queues keyed by its own record, so
+ * it can be woken without waking anyone else.
+ */
+struct futex_waiter {
+	paddr_t fw_addr;
+	struct proc *fw_proc;
+	bool fw_woken;
+	struct futex_waiter *fw_next;
+};
+
+/*
+ * A hash bucket. fb_waiters (protected by fb_lock) says who is
+ * waiting for what, for every address that hashes here.
+ */
+struct futex_bucket {
+	struct spinlock fb_lock;
+	struct futex_waiter *fb_waiters;
+};
+
+static struct futex_bucket futex_buckets[FUTEX_HASHSIZE];
+
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_HASHSIZE; i++) {
+		spinlock_init(&futex_buckets[i].fb_lock);
+		futex_buckets[i].fb_waiters = NULL;
+	}
+}
+
+static
+struct futex_bucket *
+futex_bucket(paddr_t addr)
+{
+	return &futex_buckets[(addr >> 2) % FUTEX_HASHSIZE];
+}
+
+int
+futex_wait(paddr_t addr, int32_t val)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter fw, **fwp;
+	volatile int32_t *word;
+
+	KASSERT(addr % sizeof(int32_t) == 0);
+
+	fb = futex_bucket(addr);
+	word = (volatile int32_t *)PADDR_TO_KVADDR(addr);
+
+	/*
+	 * Read the word through the kernel's direct mapping, so we
+	 * can't fault while holding the bucket lock.
+	 */
+	spinlock_acquire(&fb->fb_lock);
+	if (*word != val) {
+		spinlock_release(&fb->fb_lock);
+		return EAGAIN;
+	}
+
+	/* Join the end of the line, so wakeups are first come, first served. */
+	fw.fw_addr = addr;
+	fw.fw_proc = curproc;
+	fw.fw_woken = false;
+	fw.fw_next = NULL;
+	for (fwp = &fb->fb_waiters; *fwp != NULL; fwp = &(*fwp)->fw_next) {
+		/* nothing */
+	}
+	*fwp = &fw;
+
+	while (!fw.fw_woken) {
+		/*
+		 * _exit sets us_exiting before futex_interrupt takes
+		 * the bucket lock, so checking with the lock held
+		 * can't miss it.
+		 */
+		if (uthread_exiting()) {
+			for (fwp = &fb->fb_waiters; *fwp != &fw;
+			     fwp = &(*fwp)->fw_next) {
+				KASSERT(*fwp != NULL);
+			}
+			*fwp = fw.fw_next;
+			spinlock_release(&fb->fb_lock);
+			return EINTR;
+		}
+		/*
+		 * Wakers hold the bucket lock while they wake us, so
+		 * taking our queue before letting go of it means we're
+		 * asleep before anyone can try.
+		 */
+		sleepq_lock(SQ_FUTEX, &fw);
+		spinlock_release(&fb->fb_lock);
+		sleepq_sleep(SQ_FUTEX, &fw, "futex");
+		spinlock_acquire(&fb->fb_lock);
+	}
+	spinlock_release(&fb->fb_lock);
+
+	return 0;
+}
+
+unsigned
+futex_wake(paddr_t addr, unsigned n)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter **fwp, *fw;
+	unsigned woken;
+
+	KASSERT(addr % sizeof(int32_t) == 0);
+
+	fb = futex_bucket(addr);
+	woken = 0;
+
+	/*
+	 * Wake each one with the bucket lock still held: once we let
+	 * go, a waiter that wakes for another reason may find itself
+	 * woken and return, and its record is gone.
+	 */
+	spinlock_acquire(&fb->fb_lock);
+	fwp = &fb->fb_waiters;
+	while (*fwp != NULL && woken < n) {
+		fw = *fwp;
+		if (fw->fw_addr != addr) {
+			fwp = &fw->fw_next;
+			continue;
+		}
+		*fwp = fw->fw_next;
+		fw->fw_woken = true;
+		sleepq_wakeone(SQ_FUTEX, fw);
+		woken++;
+	}
+	spinlock_release(&fb->fb_lock);
+
+	return woken;
+}
+
+void
+futex_interrupt(struct proc *p)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter *fw;
+	unsigned i;
+
+	/*
+	 * Leave the records in place; each waiter unlinks itself when
+	 * it sees it's exiting.
+	 */
+	for (i=0; i<FUTEX_HASHSIZE; i++) {
+		fb = &futex_buckets[i];
+		spinlock_acquire(&fb->fb_lock);
+		for (fw = fb->fb_waiters; fw != NULL; fw = fw->fw_next) {
+			if (fw->fw_proc == p) {
+				sleepq_wakeone(SQ_FUTEX, fw);
+			}
+		}
+		spinlock_release(&fb->fb_lock);
+	}
+}
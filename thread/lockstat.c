@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock contention profiling. See lockstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <lockstat.h>
+
+#define LOCKSTAT_SIZE    256	/* Lock classes tracked; power of 2 */
+#define LOCKSTAT_NAMELEN 20
+
+struct lockstat {
+	bool ls_used;
+	const void *ls_site;		/* Call site, for spinlocks */
+	char ls_name[LOCKSTAT_NAMELEN];	/* Name, for sleep locks */
+	unsigned ls_count;		/* Acquisitions */
+	unsigned ls_contended;		/* ... that had to wait */
+	uint64_t ls_totalwait;		/* Times in ns */
+	uint64_t ls_maxwait;
+	uint64_t ls_totalhold;
+	uint64_t ls_maxhold;
+};
+
+/*
+ * The table is a hash table with linear probing. If it fills up,
+ * further lock classes are only counted in lockstat_overflow.
+ *
+ * It's protected by a bare lock word rather than a struct spinlock,
+ * since this is called from inside the spinlock code.
+ */
+static struct lockstat lockstats[LOCKSTAT_SIZE];
+static unsigned lockstat_overflow;
+static volatile spinlock_data_t lockstat_lock = SPINLOCK_DATA_INITIALIZER;
+
+/* Copy of the table for lockstat_print (too big for the stack). */
+static struct lockstat lockstat_snapshot[LOCKSTAT_SIZE];
+
+static
+void
+lockstat_lock_acquire(int *spl)
+{
+	*spl = splhigh();
+	while (1) {
+		if (spinlock_data_get(&lockstat_lock) != 0) {
+			continue;
+		}
+		if (spinlock_data_testandset(&lockstat_lock) != 0) {
+			continue;
+		}
+		break;
+	}
+}
+
+static
+void
+lockstat_lock_release(int spl)
+{
+	spinlock_data_set(&lockstat_lock, 0);
+	splx(spl);
+}
+
+static
+unsigned
+lockstat_hash(const char *name, const void *site)
+{
+	unsigned h = 0;
+	unsigned i;
+
+	if (name == NULL) {
+		return ((uintptr_t)site >> 2) % LOCKSTAT_SIZE;
+	}
+	for (i=0; i<LOCKSTAT_NAMELEN - 1 && name[i] != 0; i++) {
+		h = h * 31 + (unsigned char)name[i];
+	}
+	return h % LOCKSTAT_SIZE;
+}
+
+/*
+ * Names are compared (and stored) truncated to LOCKSTAT_NAMELEN-1.
+ */
+static
+bool
+lockstat_matches(struct lockstat *ls, const char *name, const void *site)
+{
+	unsigned i;
+
+	if (name == NULL) {
+		return ls->ls_name[0] == 0 && ls->ls_site == site;
+	}
+	for (i=0; i<LOCKSTAT_NAMELEN - 1; i++) {
+		if (ls->ls_name[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == 0) {
+			break;
+		}
+	}
+	return true;
+}
+
+void
+lockstat_record(const char *name, const void *site, bool contended,
+		uint64_t wait, uint64_t hold)
+{
+	struct lockstat *ls;
+	unsigned h, i, j;
+	int spl;
+
+	h = lockstat_hash(name, site);
+
+	lockstat_lock_acquire(&spl);
+	for (i=0; i<LOCKSTAT_SIZE; i++) {
+		ls = &lockstats[(h + i) % LOCKSTAT_SIZE];
+		if (!ls->ls_used) {
+			ls->ls_used = true;
+			if (name == NULL) {
+				ls->ls_site = site;
+				ls->ls_name[0] = 0;
+			}
+			else {
+				ls->ls_site = NULL;
+				for (j=0; j<LOCKSTAT_NAMELEN - 1 &&
+					     name[j] != 0; j++) {
+					ls->ls_name[j] = name[j];
+				}
+				ls->ls_name[j] = 0;
+			}
+			break;
+		}
+		if (lockstat_matches(ls, name, site)) {
+			break;
+		}
+	}
+	if (i == LOCKSTAT_SIZE) {
+		lockstat_overflow++;
+		lockstat_lock_release(spl);
+		return;
+	}
+
+	ls->ls_count++;
+	if (contended) {
+		ls->ls_contended++;
+	}
+	ls->ls_totalwait += wait;
+	if (wait > ls->ls_maxwait) {
+		ls->ls_maxwait = wait;
+	}
+	ls->ls_totalhold += hold;
+	if (hold > ls->ls_maxhold) {
+		ls->ls_maxhold = hold;
+	}
+	lockstat_lock_release(spl);
+}
+
+/*
+ * Print the TOPN most contended lock classes, most contended first.
+ * We copy the table out first, since printing takes locks (and so
+ * calls lockstat_record).
+ */
+void
+lockstat_print(unsigned topn)
+{
+	struct lockstat *ls, *best;
+	unsigned overflow, i, n;
+	char namebuf[LOCKSTAT_NAMELEN];
+	int spl;
+
+	lockstat_lock_acquire(&spl);
+	memcpy(lockstat_snapshot, lockstats, sizeof(lockstats));
+	overflow = lockstat_overflow;
+	lockstat_lock_release(spl);
+
+	kprintf("%-19s %9s %9s %11s %11s %11s %11s\n", "lock", "acquires",
+		"contended", "wait(us)", "maxwait(us)", "hold(us)",
+		"maxhold(us)");
+	for (n=0; n<topn; n++) {
+		best = NULL;
+		for (i=0; i<LOCKSTAT_SIZE; i++) {
+			ls = &lockstat_snapshot[i];
+			if (ls->ls_used && (best == NULL ||
+			    ls->ls_contended > best->ls_contended ||
+			    (ls->ls_contended == best->ls_contended &&
+			     ls->ls_totalwait > best->ls_totalwait))) {
+				best = ls;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		if (best->ls_name[0] != 0) {
+			strcpy(namebuf, best->ls_name);
+		}
+		else {
+			snprintf(namebuf, sizeof(namebuf), "spin@%p",
+				 best->ls_site);
+		}
+		kprintf("%-19s %9u %9u %11llu %11llu %11llu %11llu\n",
+			namebuf, best->ls_count, best->ls_contended,
+			best->ls_totalwait / 1000, best->ls_maxwait / 1000,
+			best->ls_totalhold / 1000, best->ls_maxhold / 1000);
+		/* Don't pick it again. */
+		best->ls_used = false;
+	}
+	if (overflow > 0) {
+		kprintf("(%u acquisitions of untracked locks; table full)\n",
+			overflow);
+	}
+}
+
+void
+lockstat_reset(void)
+{
+	int spl;
+
+	lockstat_lock_acquire(&spl);
+	bzero(lockstats, sizeof(lockstats));
+	lockstat_overflow = 0;
+	lockstat_lock_release(spl);
+}
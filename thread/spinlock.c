@@ -36,11 +36,19 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <current.h>	/* for curcpu */
+#include <clock.h>
+#include <lockstat.h>
 
 /*
  * Spinlocks.
  */
 
+/*
+ * MCS queue nodes used before curcpu exists (when there's only one
+ * cpu).
+ */
+static struct spinlock_mcsnode spinlock_bootnodes[CPU_MCSNODES];
+static unsigned spinlock_bootnodes_used;
 
 /*
  * Initialize spinlock.
@@ -50,6 +58,19 @@ spinlock_init(struct spinlock *lk)
 {
 	spinlock_data_set(&lk->lk_lock, 0);
 	lk->lk_holder = NULL;
+	lk->lk_mcs = false;
+	lk->lk_tail = NULL;
+	lk->lk_node = NULL;
+}
+
+/*
+ * Initialize an MCS spinlock.
+ */
+void
+spinlock_init_mcs(struct spinlock *lk)
+{
+	spinlock_init(lk);
+	lk->lk_mcs = true;
 }
 
 /*
@@ -60,6 +81,114 @@ spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
 	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	KASSERT(lk->lk_tail == NULL);
+}
+
+/*
+ * Get a queue node from this cpu's pool. Interrupts are off, so
+ * nothing else on this cpu can be doing this at the same time.
+ */
+static
+struct spinlock_mcsnode *
+spinlock_mcsnode_get(struct cpu *mycpu)
+{
+	struct spinlock_mcsnode *pool;
+	unsigned *used;
+	unsigned i;
+
+	if (mycpu == NULL) {
+		pool = spinlock_bootnodes;
+		used = &spinlock_bootnodes_used;
+	}
+	else {
+		pool = mycpu->c_mcsnodes;
+		used = &mycpu->c_mcsnodes_used;
+	}
+	for (i=0; i<CPU_MCSNODES; i++) {
+		if ((*used & (1U << i)) == 0) {
+			*used |= 1U << i;
+			return &pool[i];
+		}
+	}
+	panic("spinlock: too many MCS locks held at once\n");
+}
+
+/*
+ * Return a queue node to its pool. If it came from a cpu, it's this
+ * one: a spinlock is released on the cpu that acquired it.
+ */
+static
+void
+spinlock_mcsnode_put(struct spinlock_mcsnode *node)
+{
+	unsigned *used;
+	unsigned i;
+
+	if (node >= spinlock_bootnodes &&
+	    node < spinlock_bootnodes + CPU_MCSNODES) {
+		i = node - spinlock_bootnodes;
+		used = &spinlock_bootnodes_used;
+	}
+	else {
+		i = node - curcpu->c_mcsnodes;
+		used = &curcpu->c_mcsnodes_used;
+	}
+	KASSERT(i < CPU_MCSNODES);
+	KASSERT(*used & (1U << i));
+	*used &= ~(1U << i);
+}
+
+/*
+ * MCS acquire: add our node to the tail of the queue, and if there
+ * was anyone ahead of us, link in behind them and spin on our own
+ * node until they hand the lock over. Returns true if we had to wait.
+ */
+static
+bool
+spinlock_acquire_mcs(struct spinlock *lk, struct cpu *mycpu)
+{
+	struct spinlock_mcsnode *node, *pred;
+
+	node = spinlock_mcsnode_get(mycpu);
+	node->mn_next = NULL;
+	node->mn_locked = 1;
+
+	pred = spinlock_ptr_swap(&lk->lk_tail, node);
+	if (pred != NULL) {
+		pred->mn_next = node;
+		while (node->mn_locked) {
+			/* spin */
+		}
+	}
+	lk->lk_node = node;
+	return pred != NULL;
+}
+
+/*
+ * MCS release: if nobody's queued behind us, swing the tail back to
+ * empty. If that fails, someone is in the middle of queueing; wait
+ * for them to link in, then hand them the lock.
+ */
+static
+void
+spinlock_release_mcs(struct spinlock *lk)
+{
+	struct spinlock_mcsnode *node;
+
+	node = lk->lk_node;
+	lk->lk_node = NULL;
+
+	if (node->mn_next == NULL) {
+		if (spinlock_ptr_cas(&lk->lk_tail, node, NULL)) {
+			spinlock_mcsnode_put(node);
+			return;
+		}
+		while (node->mn_next == NULL) {
+			/* spin */
+		}
+	}
+	node->mn_next->mn_locked = 0;
+	spinlock_mcsnode_put(node);
 }
 
 /*
@@ -73,8 +202,15 @@ void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+	bool contended = false;
+#if OPT_LOCKSTAT
+	uint64_t start;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
+#if OPT_LOCKSTAT
+	start = getnsecs();
+#endif
 
 	/* this must work before curcpu initialization */
 	if (CURCPU_EXISTS()) {
@@ -87,7 +223,10 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
-	while (1) {
+	if (lk->lk_mcs) {
+		contended = spinlock_acquire_mcs(lk, mycpu);
+	}
+	else while (1) {
 		/*
 		 * Do test-test-and-set, that is, read first before
 		 * doing test-and-set, to reduce bus contention.
@@ -99,15 +238,26 @@ spinlock_acquire(struct spinlock *lk)
 		 * we don't.
 		 */
 		if (spinlock_data_get(&lk->lk_lock) != 0) {
+			contended = true;
 			continue;
 		}
 		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
+			contended = true;
 			continue;
 		}
 		break;
 	}
 
 	lk->lk_holder = mycpu;
+
+#if OPT_LOCKSTAT
+	lk->lk_stat_site = __builtin_return_address(0);
+	lk->lk_stat_acquired = getnsecs();
+	lk->lk_stat_wait = lk->lk_stat_acquired - start;
+	lk->lk_stat_contended = contended;
+#else
+	(void)contended;
+#endif
 }
 
 /*
@@ -116,13 +266,32 @@ spinlock_acquire(struct spinlock *lk)
 void
 spinlock_release(struct spinlock *lk)
 {
+#if OPT_LOCKSTAT
+	const void *site = lk->lk_stat_site;
+	uint64_t acquired = lk->lk_stat_acquired;
+	uint64_t wait = lk->lk_stat_wait;
+	bool contended = lk->lk_stat_contended;
+#endif
+
 	/* this must work before curcpu initialization */
 	if (CURCPU_EXISTS()) {
 		KASSERT(lk->lk_holder == curcpu->c_self);
 	}
 
 	lk->lk_holder = NULL;
-	spinlock_data_set(&lk->lk_lock, 0);
+	if (lk->lk_mcs) {
+		spinlock_release_mcs(lk);
+	}
+	else {
+		spinlock_data_set(&lk->lk_lock, 0);
+	}
+#if OPT_LOCKSTAT
+	/* Skip acquisitions from before the clock was attached. */
+	if (acquired != 0) {
+		lockstat_record(NULL, site, contended, wait,
+				getnsecs() - acquired);
+	}
+#endif
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -36,11 +36,17 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
+#include <cpu.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <clock.h>
+#include <lockstat.h>
 #include "opt-A1.h"
 
+/* See synch.h. */
+bool synch_handoff = false;
+
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
@@ -117,13 +123,19 @@ P(struct semaphore *sem)
          * strict ordering. Too bad. :-)
          *
          * Exercise: how would you implement strict FIFO
-         * ordering?
+         * ordering? (Answer: see synch_handoff.)
          */
         wchan_lock(sem->sem_wchan);
         spinlock_release(&sem->sem_lock);
                 wchan_sleep(sem->sem_wchan);
 
         spinlock_acquire(&sem->sem_lock);
+                if (curthread->t_handoff) {
+                        /* V gave us its count directly. */
+                        curthread->t_handoff = false;
+                        spinlock_release(&sem->sem_lock);
+                        return;
+                }
         }
         KASSERT(sem->sem_count > 0);
         sem->sem_count--;
@@ -137,6 +149,23 @@ V(struct semaphore *sem)
 
     spinlock_acquire(&sem->sem_lock);
 
+        if (synch_handoff) {
+                struct thread *target;
+
+                /*
+                 * Give the count straight to the longest waiter,
+                 * if any, so nobody can barge in ahead of it. It
+                 * can't look at t_handoff until we let go of
+                 * sem_lock.
+                 */
+                target = wchan_wakeone(sem->sem_wchan);
+                if (target != NULL) {
+                        target->t_handoff = true;
+                        spinlock_release(&sem->sem_lock);
+                        return;
+                }
+        }
+
         sem->sem_count++;
         KASSERT(sem->sem_count > 0);
     wchan_wakeone(sem->sem_wchan);
@@ -148,6 +177,129 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/*
+ * Adaptive spinning: if a lock's holder is running on another cpu it
+ * will likely let go soon, and waiting for it costs less than the two
+ * context switches of going to sleep. So lock_acquire polls lk_holder
+ * (without the spinlock, so as not to slow the holder down) in bursts
+ * of LOCK_SPIN_BURST, rechecking under lk_lock between bursts that the
+ * holder is still on a cpu, and sleeps once the holder blocks or
+ * lock_spin_budget polls have gone by. Between polls it backs off
+ * for a doubling number of idle loops, up to LOCK_SPIN_MAXPAUSE, so
+ * the holder gets the bus to itself. There's no pause instruction on
+ * our MIPS, so the loop body is just a compiler barrier.
+ */
+#define LOCK_SPIN_BURST 50
+#define LOCK_SPIN_MAXPAUSE 64
+
+unsigned lock_spin_budget = LOCK_SPIN_DEFAULT;
+
+/* See synch.h. */
+bool cv_wait_morphing = true;
+
+/*
+ * Priority inheritance. A thread about to sleep on a lock raises the
+ * lock's holder to its own priority, and if that holder is itself
+ * asleep on another lock, that lock's holder, and so on, up to
+ * LOCK_PI_DEPTH locks down the chain. The boost lasts until the
+ * holder has released all its locks; working out exactly which
+ * boosts are still owed at each release would mean tracking every
+ * lock a thread holds, and holding locks is meant to be brief.
+ *
+ * lk_pi_waiters counts threads asleep (or about to be) on the lock
+ * with t_blockedon set, and lk_pi_pri is the highest priority any of
+ * them had, so that whoever gets the lock next can inherit it too.
+ * Both are protected by the thread priority lock. While there are
+ * such waiters, lk_holder is changed only with the priority lock
+ * held too, which is what makes it safe to follow the chain through
+ * other locks' lk_holder without their lk_locks: a holder we find
+ * can't release the lock, let alone exit, while we look.
+ */
+#define LOCK_PI_DEPTH 8
+
+bool lock_priority_inheritance = true;
+
+#if OPT_A1
+static
+void
+lock_pi_block(struct lock *lock)
+{
+        struct lock *l;
+        struct thread *holder;
+        int pri, depth;
+
+        KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+        thread_prilock_acquire();
+        pri = curthread->t_pri;
+        curthread->t_blockedon = lock;
+        lock->lk_pi_waiters++;
+
+        l = lock;
+        for (depth=0; l != NULL && depth < LOCK_PI_DEPTH; depth++) {
+                if (l->lk_pi_pri < pri) {
+                        l->lk_pi_pri = pri;
+                }
+                holder = (struct thread *)l->lk_holder;
+                if (holder == NULL || holder->t_pri >= pri) {
+                        break;
+                }
+                thread_setpri(holder, pri);
+                l = holder->t_blockedon;
+        }
+        thread_prilock_release();
+}
+
+static
+void
+lock_pi_unblock(struct lock *lock)
+{
+        KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+        KASSERT(curthread->t_blockedon == lock);
+
+        thread_prilock_acquire();
+        curthread->t_blockedon = NULL;
+        KASSERT(lock->lk_pi_waiters > 0);
+        lock->lk_pi_waiters--;
+        if (lock->lk_pi_waiters == 0) {
+                lock->lk_pi_pri = THREAD_PRI_MIN;
+        }
+        thread_prilock_release();
+}
+
+/*
+ * We just got the lock; if others are still waiting, inherit from
+ * them what the previous holder had.
+ */
+static
+void
+lock_pi_acquired(struct lock *lock)
+{
+        KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+        thread_prilock_acquire();
+        if (curthread->t_pri < lock->lk_pi_pri) {
+                thread_setpri(curthread, lock->lk_pi_pri);
+        }
+        thread_prilock_release();
+}
+
+/*
+ * Drop any inherited priority once we hold no more locks.
+ */
+static
+void
+lock_pi_released(void)
+{
+        thread_prilock_acquire();
+        if (curthread->t_locksheld == 0 &&
+            curthread->t_pri != curthread->t_basepri) {
+                thread_setpri(curthread, curthread->t_basepri);
+        }
+        thread_prilock_release();
+}
+#endif /* OPT_A1 */
+
 struct lock *
 lock_create(const char *name)
 {
@@ -158,22 +310,14 @@ lock_create(const char *name)
                 return NULL;
         }
 
-        lock->lk_name = kstrdup(name);
-        if (lock->lk_name == NULL) {
-                kfree(lock);
-                return NULL;
-        }
-        
+        lock->lk_name = name;
+
         // add stuff here as needed
         #if OPT_A1
-        lock->lk_wchan = wchan_create(lock->lk_name);
-        if(lock->lk_wchan == NULL) {
-            kfree(lock->lk_name);
-            kfree(lock);
-            return NULL;
-        }
         spinlock_init(&lock->lk_lock);
         lock->lk_holder = NULL; //nobody holds new lock
+        lock->lk_pi_waiters = 0;
+        lock->lk_pi_pri = THREAD_PRI_MIN;
         #endif
         
         return lock;
@@ -189,10 +333,8 @@ lock_destroy(struct lock *lock)
         KASSERT(lock->lk_holder == NULL); //make sure nobody has lock
 
         spinlock_cleanup(&lock->lk_lock);
-        wchan_destroy(lock->lk_wchan);
 
         #endif 
-        kfree(lock->lk_name);
         kfree(lock);
 }
 
@@ -200,17 +342,77 @@ void
 lock_acquire(struct lock *lock)
 {
         #if OPT_A1
+        struct thread *holder;
+        unsigned spins = 0, pause, i, j;
+#if OPT_LOCKSTAT
+        uint64_t start = getnsecs();
+        bool contended = false;
+#endif
+
         KASSERT(curthread->t_in_interrupt == false);    //are interupts disabled
 
         spinlock_acquire(&lock->lk_lock);       //get spinlock for atomic operation
+        /*
+         * t_handoff means lock_release handed it to us while we
+         * slept (see synch_handoff); this includes waiters
+         * cv_broadcast moved to our queue, which get here from
+         * cv_wait. Otherwise holding it already is a bug.
+         */
+        KASSERT(lock->lk_holder != curthread || curthread->t_handoff);
         //need to verify folowing while block
-        while(lock->lk_holder != NULL) {        //while another thread has the lock
-            wchan_lock(lock->lk_wchan);         //get wait chanel lock
+        while(!curthread->t_handoff && lock->lk_holder != NULL) {        //while another thread has the lock
+#if OPT_LOCKSTAT
+            contended = true;
+#endif
+            /*
+             * The holder can't let go (or exit) while we have
+             * lk_lock, so it's safe to look at it here.
+             */
+            holder = lock->lk_holder;
+            if (spins < lock_spin_budget && holder->t_state == S_RUN &&
+                holder->t_cpu != curcpu->c_self) {
+                spinlock_release(&lock->lk_lock);
+                pause = 1;
+                for (i=0; i<LOCK_SPIN_BURST; i++) {
+                    if (lock->lk_holder != holder) {
+                        break;
+                    }
+                    for (j=0; j<pause; j++) {
+                        __asm volatile("" ::: "memory");
+                    }
+                    if (pause < LOCK_SPIN_MAXPAUSE) {
+                        pause *= 2;
+                    }
+                }
+                spins += LOCK_SPIN_BURST;
+                spinlock_acquire(&lock->lk_lock);
+                continue;
+            }
+            if (lock_priority_inheritance) {
+                lock_pi_block(lock);
+            }
+            sleepq_lock(SQ_LOCK, lock);         //get wait queue lock
             spinlock_release(&lock->lk_lock);   //release spinlock
-            wchan_sleep(lock->lk_wchan);        //wait
+            sleepq_sleep(SQ_LOCK, lock, lock->lk_name); //wait
             spinlock_acquire(&lock->lk_lock);   //reaquire spinlock to check again
+            if (curthread->t_blockedon != NULL) {
+                lock_pi_unblock(lock);
+            }
+        }
+        if (curthread->t_handoff) {
+            KASSERT(lock->lk_holder == curthread);
+            curthread->t_handoff = false;
         }
         lock->lk_holder = curthread;            //give lock to current thread
+        curthread->t_locksheld++;
+        if (lock->lk_pi_waiters > 0) {
+            lock_pi_acquired(lock);
+        }
+#if OPT_LOCKSTAT
+        lock->lk_stat_acquired = getnsecs();
+        lock->lk_stat_wait = lock->lk_stat_acquired - start;
+        lock->lk_stat_contended = contended;
+#endif
         spinlock_release(&lock->lk_lock);
         
         #else
@@ -222,12 +424,53 @@ void
 lock_release(struct lock *lock)
 {
         #if OPT_A1
+        bool pi;
+
         spinlock_acquire(&lock->lk_lock);       //get spinlock for atomic action
 
+#if OPT_LOCKSTAT
+        /*
+         * Record while we still have lk_lock: once the lock is
+         * released it (and its name) may be destroyed.
+         */
+        if (lock->lk_stat_acquired != 0) {
+                lockstat_record(lock->lk_name, NULL,
+                                lock->lk_stat_contended, lock->lk_stat_wait,
+                                getnsecs() - lock->lk_stat_acquired);
+        }
+#endif
+        /* See lock_pi_block for why we might need the priority lock. */
+        pi = lock->lk_pi_waiters > 0;
+        if (pi) {
+                thread_prilock_acquire();
+        }
         lock->lk_holder = NULL;                 //relsease lock
-        wchan_wakeone(lock->lk_wchan);          //signal kernel to wake a waiting thread
+        if (synch_handoff) {
+                /*
+                 * Make the longest sleeper the holder before it
+                 * runs, so threads arriving meanwhile (or
+                 * spinning) can't take the lock from it. It
+                 * can't check until we drop lk_lock.
+                 */
+                lock->lk_holder = sleepq_wakeone(SQ_LOCK, lock);
+                if (lock->lk_holder != NULL) {
+                        lock->lk_holder->t_handoff = true;
+                }
+        }
+        else {
+                sleepq_wakeone(SQ_LOCK, lock);  //signal kernel to wake a waiting thread
+        }
+        if (pi) {
+                thread_prilock_release();
+        }
 
         spinlock_release(&lock->lk_lock);       //release spinlock
+
+        KASSERT(curthread->t_locksheld > 0);
+        curthread->t_locksheld--;
+        if (curthread->t_pri != curthread->t_basepri) {
+                lock_pi_released();
+        }
         
         #else
         (void)lock;  // suppress warning until code gets written
@@ -271,19 +514,7 @@ cv_create(const char *name)
                 return NULL;
         }
 
-        cv->cv_name = kstrdup(name);
-        if (cv->cv_name == NULL) {
-                kfree(cv);
-                return NULL;
-        }
-        
-        #if OPT_A1
-        cv->cv_wchan = wchan_create(cv->cv_name);
-        if(cv->cv_wchan == NULL){
-            kfree(cv->cv_name);
-            kfree(cv);
-        }
-        #endif
+        cv->cv_name = name;
 
         return cv;
 }
@@ -293,11 +524,6 @@ cv_destroy(struct cv *cv)
 {
         KASSERT(cv != NULL);
 
-        #if OPT_A1
-        wchan_destroy(cv->cv_wchan);
-        #endif
-        
-        kfree(cv->cv_name);
         kfree(cv);
 }
 
@@ -305,9 +531,21 @@ void
 cv_wait(struct cv *cv, struct lock *lock)
 {
         #if OPT_A1
+        /*
+         * Get on the CV's sleep queue before letting go of the
+         * lock, or a signal sent in between would be lost.
+         * lock_release is safe to call with the queue locked: it
+         * only takes spinlocks, and SQ_LOCK queues come after SQ_CV
+         * ones in the lock order.
+         *
+         * If we were moved to the lock's queue (see
+         * cv_wait_morphing) we come back from sleepq_sleep when the
+         * lock was released, and lock_acquire will very likely get
+         * it without sleeping again.
+         */
+        sleepq_lock(SQ_CV, cv);     //need the queue locked to sleep
         lock_release(lock);         //release lock
-        wchan_lock(cv->cv_wchan);   //need wchan_lock to sleep
-        wchan_sleep(cv->cv_wchan);  //sleep
+        sleepq_sleep(SQ_CV, cv, cv->cv_name); //sleep
         lock_acquire(lock);         //reaquire lock after sleep
         #else
         (void)cv;    // suppress warning until code gets written
@@ -321,7 +559,13 @@ cv_signal(struct cv *cv, struct lock *lock)
     
         #if OPT_A1
         KASSERT(lock_do_i_hold(lock));
-        wchan_wakeone(cv->cv_wchan); //signal to kernel that resouce is ready for another thread
+        if (cv_wait_morphing) {
+                /* We hold the lock, so our release will wake it. */
+                sleepq_requeue(SQ_CV, cv, SQ_LOCK, lock, 1);
+        }
+        else {
+                sleepq_wakeone(SQ_CV, cv); //signal to kernel that resouce is ready for another thread
+        }
         #else
         (void)cv;    // suppress warning until code gets written
         (void)lock;  // suppress warning until code gets written
@@ -334,9 +578,149 @@ cv_broadcast(struct cv *cv, struct lock *lock)
     
         #if OPT_A1
         KASSERT(lock_do_i_hold(lock));
-        wchan_wakeall(cv->cv_wchan);
+        if (cv_wait_morphing) {
+                /* Each lock_release from here on wakes one of them. */
+                sleepq_requeue(SQ_CV, cv, SQ_LOCK, lock, (unsigned)-1);
+        }
+        else {
+                sleepq_wakeall(SQ_CV, cv);
+        }
         #else
         (void)cv;    // suppress warning until code gets written
         (void)lock;  // suppress warning until code gets written
         #endif
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rw;
+
+        rw = kmalloc(sizeof(struct rwlock));
+        if (rw == NULL) {
+                return NULL;
+        }
+
+        rw->rw_name = kstrdup(name);
+        if (rw->rw_name == NULL) {
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_readwchan = wchan_create(rw->rw_name);
+        if (rw->rw_readwchan == NULL) {
+                kfree(rw->rw_name);
+                kfree(rw);
+                return NULL;
+        }
+        rw->rw_writewchan = wchan_create(rw->rw_name);
+        if (rw->rw_writewchan == NULL) {
+                wchan_destroy(rw->rw_readwchan);
+                kfree(rw->rw_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        spinlock_init(&rw->rw_lock);
+        rw->rw_readers = 0;
+        rw->rw_waitingwriters = 0;
+        rw->rw_writer = NULL;
+
+        return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_readers == 0);
+        KASSERT(rw->rw_writer == NULL);
+        KASSERT(rw->rw_waitingwriters == 0);
+
+        spinlock_cleanup(&rw->rw_lock);
+        wchan_destroy(rw->rw_writewchan);
+        wchan_destroy(rw->rw_readwchan);
+        kfree(rw->rw_name);
+        kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&rw->rw_lock);
+        while (rw->rw_writer != NULL || rw->rw_waitingwriters > 0) {
+                KASSERT(rw->rw_writer != curthread);
+                wchan_lock(rw->rw_readwchan);
+                spinlock_release(&rw->rw_lock);
+                wchan_sleep(rw->rw_readwchan);
+                spinlock_acquire(&rw->rw_lock);
+        }
+        rw->rw_readers++;
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&rw->rw_lock);
+        KASSERT(rw->rw_writer != curthread);
+        rw->rw_waitingwriters++;
+        while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+                wchan_lock(rw->rw_writewchan);
+                spinlock_release(&rw->rw_lock);
+                wchan_sleep(rw->rw_writewchan);
+                spinlock_acquire(&rw->rw_lock);
+        }
+        rw->rw_waitingwriters--;
+        rw->rw_writer = curthread;
+        spinlock_release(&rw->rw_lock);
+}
+
+/*
+ * When the lock becomes free, hand it to a waiting writer if there
+ * is one; only once no writers are left do the readers get to go.
+ */
+void
+rwlock_release(struct rwlock *rw)
+{
+        spinlock_acquire(&rw->rw_lock);
+        if (rw->rw_writer != NULL) {
+                KASSERT(rw->rw_writer == curthread);
+                KASSERT(rw->rw_readers == 0);
+                rw->rw_writer = NULL;
+        }
+        else {
+                KASSERT(rw->rw_readers > 0);
+                rw->rw_readers--;
+        }
+
+        if (rw->rw_readers == 0) {
+                if (rw->rw_waitingwriters > 0) {
+                        wchan_wakeone(rw->rw_writewchan);
+                }
+                else {
+                        wchan_wakeall(rw->rw_readwchan);
+                }
+        }
+        spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+        bool ret;
+
+        spinlock_acquire(&rw->rw_lock);
+        ret = (rw->rw_writer == curthread);
+        spinlock_release(&rw->rw_lock);
+
+        return ret;
+}
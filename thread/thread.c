@@ -38,6 +38,7 @@
 #include <lib.h>
 #include <array.h>
 #include <cpu.h>
+#include <percpu.h>
 #include <spl.h>
 #include <spinlock.h>
 #include <wchan.h>
@@ -50,8 +51,12 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <clock.h>
+#include <workqueue.h>
+#include <epoch.h>
 
 #include "opt-synchprobs.h"
+#include "opt-schedstats.h"
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -72,6 +77,55 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* When the statistics printed by thread_printstats were last reset. */
+static time_t stats_secs;
+static uint32_t stats_nsecs;
+
+/*
+ * Timestamps for the scheduler accounting (see thread_printsched).
+ * Reading the clock on every switch isn't free, so without "options
+ * schedstats" they're all 0, which the accounting already treats as
+ * "no timestamp" and skips; the switch counts are still kept.
+ */
+#if OPT_SCHEDSTATS
+#define SCHED_NOW()	getnsecs()
+#else
+#define SCHED_NOW()	0
+#endif
+
+/*
+ * Load balancing policy. See thread_consider_migration() and
+ * thread_steal().
+ */
+int thread_balance_policy = THREAD_BALANCE_STEAL;
+
+/* Where woken threads go. See thread_wakeup_place(). */
+int thread_wakeup_policy = THREAD_WAKEUP_IDLE;
+
+/* How remote wakeups are delivered. See thread_make_runnable(). */
+bool thread_remote_wakeq = true;
+
+/*
+ * A thread that was switched out fewer than this many hardclocks ago
+ * probably still has a warm cache on its cpu; don't steal it.
+ */
+#define THREAD_STEAL_HOT	2
+
+/* Per-cpu limit on cached threads. See exorcise(). */
+unsigned thread_cache_max = THREAD_CACHE_DEFAULT;
+
+/*
+ * List of all live threads, for thread_printsched. Threads go on it
+ * when forked (or created for a new cpu) and come off it in
+ * thread_exit, so anything on it has a valid name.
+ */
+static struct thread *allthreads;
+static unsigned allthreads_count;
+static struct spinlock allthreads_lock = SPINLOCK_INITIALIZER;
+
+/* Protects t_pri and t_blockedon in all threads. */
+static struct spinlock thread_prilock = SPINLOCK_INITIALIZER;
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -112,26 +166,24 @@ thread_checkstack(struct thread *thread)
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Initialize a new thread, or a cached one being reused. Everything
+ * is set up except t_stack, which a cached thread keeps.
  */
 static
-struct thread *
-thread_create(const char *name)
+int
+thread_init(struct thread *thread, const char *name)
 {
-	struct thread *thread;
-
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
+	if (strlen(name) < sizeof(thread->t_namebuf)) {
+		strcpy(thread->t_namebuf, name);
+		thread->t_name = thread->t_namebuf;
 	}
-
-	thread->t_name = kstrdup(name);
-	if (thread->t_name == NULL) {
-		kfree(thread);
-		return NULL;
+	else {
+		thread->t_name = kstrdup(name);
+		if (thread->t_name == NULL) {
+			return ENOMEM;
+		}
 	}
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
@@ -139,10 +191,33 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_tid = 0;
+	thread->t_lastrun = 0;
+	thread->t_affinity = THREAD_AFFINITY_ALL;
+	thread->t_quantum = DEFAULT_QUANTUM;
+	thread->t_ticksleft = DEFAULT_QUANTUM;
+	thread->t_allnext = NULL;
+	thread->t_allprevp = NULL;
+	thread->t_wakenext = NULL;
+
+	/* Scheduler accounting */
+	thread->t_readysince = 0;
+	thread->t_oncpusince = SCHED_NOW();
+	thread->t_waittime = 0;
+	thread->t_runtime = 0;
+	thread->t_voluntary = 0;
+	thread->t_involuntary = 0;
+	thread->t_migrations = 0;
+	thread->t_woken = false;
+	thread->t_handoff = false;
+	thread->t_sleepkey = NULL;
+	thread->t_basepri = THREAD_PRI_DEFAULT;
+	thread->t_pri = THREAD_PRI_DEFAULT;
+	thread->t_blockedon = NULL;
+	thread->t_locksheld = 0;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
@@ -151,6 +226,92 @@ thread_create(const char *name)
 
 	/* If you add to struct thread, be sure to initialize here */
 
+	return 0;
+}
+
+/*
+ * Add a thread to, or remove it from, the list of all threads.
+ */
+static
+void
+allthreads_add(struct thread *thread)
+{
+	spinlock_acquire(&allthreads_lock);
+	thread->t_allnext = allthreads;
+	if (allthreads != NULL) {
+		allthreads->t_allprevp = &thread->t_allnext;
+	}
+	thread->t_allprevp = &allthreads;
+	allthreads = thread;
+	allthreads_count++;
+	spinlock_release(&allthreads_lock);
+}
+
+static
+void
+allthreads_remove(struct thread *thread)
+{
+	spinlock_acquire(&allthreads_lock);
+	KASSERT(thread->t_allprevp != NULL);
+	*thread->t_allprevp = thread->t_allnext;
+	if (thread->t_allnext != NULL) {
+		thread->t_allnext->t_allprevp = thread->t_allprevp;
+	}
+	thread->t_allnext = NULL;
+	thread->t_allprevp = NULL;
+	allthreads_count--;
+	spinlock_release(&allthreads_lock);
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	thread = kmalloc(sizeof(*thread));
+	if (thread == NULL) {
+		return NULL;
+	}
+	thread->t_stack = NULL;
+
+	if (thread_init(thread, name)) {
+		kfree(thread);
+		return NULL;
+	}
+
+	return thread;
+}
+
+/*
+ * Get a thread from this cpu's cache of exited ones. Returns NULL if
+ * there aren't any.
+ */
+static
+struct thread *
+thread_cache_get(const char *name)
+{
+	struct thread *thread;
+	int spl;
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	splx(spl);
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	KASSERT(thread->t_stack != NULL);
+	if (thread_init(thread, name)) {
+		/* Out of memory for a long name; just toss it */
+		kfree(thread->t_stack);
+		kfree(thread);
+		return NULL;
+	}
 	return thread;
 }
 
@@ -176,14 +337,28 @@ cpu_create(unsigned hardware_number)
 	
 	c->c_self = c;
 	c->c_hardware_number = hardware_number;
+	c->c_percpu = percpu_create();
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_threadcache);
 	c->c_hardclocks = 0;
+	c->c_switches = 0;
+	c->c_hardclock_stopped = false;
+	c->c_mcsnodes_used = 0;
+	c->c_migrating = NULL;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	spinlock_init_mcs(&c->c_runqueue_lock);
+	c->c_wakeq = NULL;
+
+	c->c_workqueue = NULL;
+
+	c->c_timeouts = timeoutwheel_create();
+	if (c->c_timeouts == NULL) {
+		panic("cpu_create: timeoutwheel_create failed\n");
+	}
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -193,6 +368,8 @@ cpu_create(unsigned hardware_number)
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+	/* Affinity masks have one bit per cpu. */
+	KASSERT(c->c_number < 32);
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -221,12 +398,30 @@ cpu_create(unsigned hardware_number)
 		thread_checkstack_init(c->c_curthread);
 	}
 	c->c_curthread->t_cpu = c;
+	allthreads_add(c->c_curthread);
 
 	cpu_machdep_init(c);
 
 	return c;
 }
 
+/*
+ * Look up cpus. The set of cpus doesn't change once they've all
+ * been started, so no locking is needed.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+struct cpu *
+cpu_get(unsigned number)
+{
+	KASSERT(number < cpuarray_num(&allcpus));
+	return cpuarray_get(&allcpus, number);
+}
+
 /*
  * Destroy a thread.
  *
@@ -249,6 +444,7 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
+	KASSERT(thread->t_allprevp == NULL);
 	if (thread->t_stack != NULL) {
 		kfree(thread->t_stack);
 	}
@@ -258,7 +454,9 @@ thread_destroy(struct thread *thread)
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread->t_name);
+	if (thread->t_name != thread->t_namebuf) {
+		kfree(thread->t_name);
+	}
 	kfree(thread);
 }
 
@@ -267,6 +465,11 @@ thread_destroy(struct thread *thread)
  * need to have thread_destroy called on them.)
  *
  * The list of zombies is per-cpu.
+ *
+ * This runs at the end of every context switch, so it doesn't free
+ * anything: zombies are moved to this cpu's thread cache (if they
+ * have a stack and a name that doesn't need freeing) while there's
+ * room, and the rest are left for thread_reap().
  */
 static
 void
@@ -274,11 +477,54 @@ exorcise(void)
 {
 	struct thread *z;
 
+	while (curcpu->c_threadcache.tl_count < thread_cache_max) {
+		z = threadlist_remhead(&curcpu->c_zombies);
+		if (z == NULL) {
+			break;
+		}
+		KASSERT(z != curthread);
+		KASSERT(z->t_state == S_ZOMBIE);
+		KASSERT(z->t_proc == NULL);
+		if (z->t_stack == NULL || z->t_name != z->t_namebuf) {
+			/* Not reusable; put it back for thread_reap. */
+			threadlist_addhead(&curcpu->c_zombies, z);
+			break;
+		}
+		thread_machdep_cleanup(&z->t_machdep);
+		z->t_wchan_name = "CACHED";
+		threadlist_addtail(&curcpu->c_threadcache, z);
+	}
+}
+
+/*
+ * Destroy the zombies exorcise() didn't cache. Called with
+ * interrupts on, from thread_fork and thread_exit, so the freeing
+ * happens outside the context switch path. The zombies are taken
+ * off the list with interrupts off (so a context switch can't be
+ * adding to it) and destroyed afterwards.
+ */
+static
+void
+thread_reap(void)
+{
+	struct threadlist tl;
+	struct thread *z;
+	int spl;
+
+	threadlist_init(&tl);
+
+	spl = splhigh();
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
+		threadlist_addtail(&tl, z);
+	}
+	splx(spl);
+
+	while ((z = threadlist_remhead(&tl)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
 		thread_destroy(z);
 	}
+	threadlist_cleanup(&tl);
 }
 
 /*
@@ -350,6 +596,7 @@ thread_bootstrap(void)
 	struct thread *bootthread;
 
 	cpuarray_init(&allcpus);
+	sleepq_bootstrap();
 
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
@@ -416,6 +663,9 @@ thread_start_cpus(void)
 
 	kprintf("cpu0: %s\n", cpu_identify());
 
+	/* Start the clock for thread_printstats. */
+	gettime(&stats_secs, &stats_nsecs);
+
 	cpu_startup_sem = sem_create("cpu_hatch", 0);
 	mainbus_start_cpus();
 	
@@ -426,10 +676,95 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Push a thread onto another cpu's wakeup queue. If the queue was
+ * empty, the cpu hasn't been told about it yet, so send it an IPI;
+ * otherwise one is already on its way.
+ *
+ * The queue is only ever emptied all at once (see
+ * thread_wakeq_drain), never popped, so the compare-and-swap can't
+ * be fooled by a node going and coming back.
+ */
+static
+void
+thread_wakeq_push(struct cpu *c, struct thread *t)
+{
+	void *old;
+
+	do {
+		old = c->c_wakeq;
+		t->t_wakenext = old;
+	} while (!spinlock_ptr_cas(&c->c_wakeq, old, t));
+
+	if (old == NULL) {
+		ipi_send(c, IPI_WAKEUP);
+	}
+}
+
+/*
+ * Put T on C's run queue, behind everything of the same or higher
+ * priority. Searching from the tail makes the usual case, where
+ * everything has the same priority, constant time.
+ */
+static
+void
+thread_runqueue_add(struct cpu *c, struct thread *t)
+{
+	struct threadlistnode *tln;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (tln = c->c_runqueue.tl_tail.tln_prev; tln->tln_prev != NULL;
+	     tln = tln->tln_prev) {
+		if (tln->tln_self->t_pri >= t->t_pri) {
+			threadlist_insertafter(&c->c_runqueue,
+					       tln->tln_self, t);
+			return;
+		}
+	}
+	threadlist_addhead(&c->c_runqueue, t);
+}
+
+/*
+ * Move the threads other cpus have queued for this one onto its run
+ * queue, oldest first. Call with the run queue lock held.
+ */
+static
+void
+thread_wakeq_drain(void)
+{
+	struct thread *t, *next, *list;
+
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	if (curcpu->c_wakeq == NULL) {
+		return;
+	}
+	t = spinlock_ptr_swap(&curcpu->c_wakeq, NULL);
+
+	/* Reverse it, since it's newest first. */
+	list = NULL;
+	while (t != NULL) {
+		next = t->t_wakenext;
+		t->t_wakenext = list;
+		list = t;
+		t = next;
+	}
+
+	for (t = list; t != NULL; t = next) {
+		next = t->t_wakenext;
+		t->t_wakenext = NULL;
+		thread_runqueue_add(curcpu->c_self, t);
+	}
+}
+
 /*
  * Make a thread runnable.
  *
- * targetcpu might be curcpu; it might not be, too. 
+ * targetcpu might be curcpu; it might not be, too. If it isn't, and
+ * we don't already hold its run queue lock, the thread goes on its
+ * wakeup queue instead (if thread_remote_wakeq is set), so the
+ * wakeup doesn't contend with targetcpu's own scheduling.
  */
 static
 void
@@ -438,9 +773,19 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	struct cpu *targetcpu;
 	bool isidle;
 
-	/* Lock the run queue of the target thread's cpu. */
 	targetcpu = target->t_cpu;
 
+	/* Start the clock on its run queue wait. */
+	target->t_readysince = SCHED_NOW();
+	target->t_woken = (target->t_state == S_SLEEP);
+
+	if (!already_have_lock && thread_remote_wakeq &&
+	    targetcpu != curcpu->c_self) {
+		thread_wakeq_push(targetcpu, target);
+		return;
+	}
+
+	/* Lock the run queue of the target thread's cpu. */
 	if (already_have_lock) {
 		/* The target thread's cpu should be already locked. */
 		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
@@ -450,7 +795,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	thread_runqueue_add(targetcpu, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -464,6 +809,109 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 }
 
+/*
+ * Choose a cpu for thread T, which mustn't be running or queued
+ * anywhere, out of the ones its affinity allows: an idle one if there
+ * is one, trying the one it last ran on and then the current one
+ * first; failing that, the one it last ran on if allowed, or else
+ * the one with the shortest run queue.
+ *
+ * Idleness and run queue lengths are peeked at without locking, so
+ * the choice is only a good guess.
+ */
+static
+struct cpu *
+thread_pickcpu(struct thread *t)
+{
+	struct cpu *c, *best;
+	unsigned i;
+
+	if (THREAD_CPU_ALLOWED(t, t->t_cpu) && t->t_cpu->c_isidle) {
+		return t->t_cpu;
+	}
+	if (THREAD_CPU_ALLOWED(t, curcpu) && curcpu->c_isidle) {
+		return curcpu->c_self;
+	}
+
+	best = NULL;
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (!THREAD_CPU_ALLOWED(t, c)) {
+			continue;
+		}
+		if (c->c_isidle) {
+			return c;
+		}
+		if (best == NULL ||
+		    c->c_runqueue.tl_count < best->c_runqueue.tl_count) {
+			best = c;
+		}
+	}
+	KASSERT(best != NULL);
+
+	if (THREAD_CPU_ALLOWED(t, t->t_cpu)) {
+		return t->t_cpu;
+	}
+	return best;
+}
+
+/*
+ * Decide where a thread being woken up should run, per
+ * thread_wakeup_policy, and retarget it there.
+ *
+ * If the cpu it slept on went idle straight from running it, that
+ * cpu is still idling on its stack (see thread_switch) and the
+ * thread can't run anywhere else until it's been switched off. A
+ * cpu holds its run queue lock through a switch except while idling,
+ * so check for that under the lock.
+ */
+static
+void
+thread_wakeup_place(struct thread *target)
+{
+	struct cpu *prev, *c;
+
+	prev = target->t_cpu;
+	if (thread_wakeup_policy != THREAD_WAKEUP_IDLE || prev->c_isidle) {
+		return;
+	}
+
+	c = thread_pickcpu(target);
+	if (c == prev) {
+		return;
+	}
+
+	spinlock_acquire(&prev->c_runqueue_lock);
+	if (prev->c_curthread != target) {
+		target->t_cpu = c;
+		target->t_migrations++;
+	}
+	spinlock_release(&prev->c_runqueue_lock);
+}
+
+/*
+ * Finish moving a thread thread_switch set aside because it may no
+ * longer run on this cpu (see thread_setaffinity). Called after the
+ * switch is complete, from the tail of thread_switch and from
+ * thread_startup, once the run queue lock is released.
+ */
+static
+void
+thread_finish_migration(void)
+{
+	struct thread *t;
+
+	t = curcpu->c_migrating;
+	if (t == NULL) {
+		return;
+	}
+	curcpu->c_migrating = NULL;
+
+	t->t_cpu = thread_pickcpu(t);
+	t->t_migrations++;
+	thread_make_runnable(t, false);
+}
+
 /*
  * Create a new thread based on an existing one.
  *
@@ -473,12 +921,16 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
  * The new thread is created in the process P. If P is null, the
  * process is inherited from the caller. It will start on the same CPU
  * as the caller, unless the scheduler intervenes first.
+ *
+ * If PINCPU is not null, the thread starts on that cpu instead and
+ * may only run there. Otherwise it inherits the caller's affinity.
  */
+static
 int
-thread_fork(const char *name,
-	    struct proc *proc,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2)
+thread_dofork(const char *name,
+	      struct proc *proc, struct cpu *pincpu,
+	      void (*entrypoint)(void *data1, unsigned long data2),
+	      void *data1, unsigned long data2)
 {
 	struct thread *newthread;
 	int result;
@@ -487,16 +939,22 @@ thread_fork(const char *name,
 	DEBUG(DB_THREADS,"Forking thread: %s\n",name);
 #endif // UW
 
-	newthread = thread_create(name);
+	thread_reap();
+
+	/* Reuse an exited thread and its stack if we can */
+	newthread = thread_cache_get(name);
 	if (newthread == NULL) {
-		return ENOMEM;
-	}
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		/* Allocate a stack */
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
 	}
 	thread_checkstack_init(newthread);
 
@@ -505,7 +963,18 @@ thread_fork(const char *name,
 	 */
 
 	/* Thread subsystem fields */
-	newthread->t_cpu = curthread->t_cpu;
+	if (pincpu != NULL) {
+		newthread->t_cpu = pincpu;
+		newthread->t_affinity = 1U << pincpu->c_number;
+	}
+	else {
+		newthread->t_cpu = curthread->t_cpu;
+		newthread->t_affinity = curthread->t_affinity;
+	}
+	newthread->t_quantum = curthread->t_quantum;
+	newthread->t_ticksleft = newthread->t_quantum;
+	newthread->t_basepri = curthread->t_basepri;
+	newthread->t_pri = curthread->t_basepri;
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -528,12 +997,144 @@ thread_fork(const char *name,
 	/* Set up the switchframe so entrypoint() gets called */
 	switchframe_init(newthread, entrypoint, data1, data2);
 
+	allthreads_add(newthread);
+
 	/* Lock the current cpu's run queue and make the new thread runnable */
 	thread_make_runnable(newthread, false);
 
 	return 0;
 }
 
+int
+thread_fork(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2)
+{
+	return thread_dofork(name, proc, NULL, entrypoint, data1, data2);
+}
+
+/*
+ * Create a kernel thread that always runs on cpu C.
+ */
+int
+thread_fork_pinned(const char *name, struct cpu *c,
+		   void (*entrypoint)(void *data1, unsigned long data2),
+		   void *data1, unsigned long data2)
+{
+	KASSERT(c != NULL);
+	return thread_dofork(name, kproc, c, entrypoint, data1, data2);
+}
+
+/*
+ * Work stealing.
+ *
+ * Called from the idle loop in thread_switch when the current cpu's
+ * run queue is empty. Find the cpu with the longest run queue and
+ * take the first thread off it that doesn't look cache-hot, that is,
+ * one that hasn't run in the last THREAD_STEAL_HOT hardclocks. The
+ * stolen thread is returned, already retargeted to the current cpu;
+ * if there's nothing worth stealing, returns NULL.
+ *
+ * The run queue lengths (and the victim's hardclock count) are read
+ * without holding the other cpus' run queue locks. They're only used
+ * as a hint for picking a victim, and we recheck everything under the
+ * victim's lock, so this is safe; it also means an idle cpu never has
+ * to hold more than one run queue lock at a time.
+ *
+ * Must be called with interrupts off and without holding the current
+ * cpu's run queue lock.
+ */
+static
+struct thread *
+thread_steal(void)
+{
+	unsigned i, numcpus, count, maxcount;
+	struct cpu *c, *victim;
+	struct threadlistnode *tln;
+	struct thread *t;
+
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(!spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	victim = NULL;
+	maxcount = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		count = c->c_runqueue.tl_count;
+		if (count > maxcount) {
+			maxcount = count;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	t = NULL;
+	for (tln = victim->c_runqueue.tl_head.tln_next;
+	     tln->tln_next != NULL;
+	     tln = tln->tln_next) {
+		/*
+		 * Never take the victim's curthread; see the comments
+		 * in thread_consider_migration for how it can end up
+		 * on the run queue.
+		 */
+		if (tln->tln_self == victim->c_curthread ||
+		    !THREAD_CPU_ALLOWED(tln->tln_self, curcpu)) {
+			continue;
+		}
+		if (victim->c_hardclocks - tln->tln_self->t_lastrun
+		    < THREAD_STEAL_HOT) {
+			continue;
+		}
+		t = tln->tln_self;
+		break;
+	}
+	if (t != NULL) {
+		threadlist_remove(&victim->c_runqueue, t);
+		t->t_cpu = curcpu->c_self;
+		t->t_migrations++;
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u\n",
+		      t->t_name, victim->c_number, curcpu->c_number);
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	return t;
+}
+
+/*
+ * Wakeup latency histogram for threads run on each cpu. Bucket 0
+ * counts latencies under 1 us, bucket n those from 2^(n-1) us up to
+ * 2^n us; the last also counts anything longer. Only updated by
+ * thread_switch, with interrupts off, so plain increments do. See
+ * thread_printsched().
+ */
+#define WAKELAT_BUCKETS 16
+static PERCPU_DEFINE(unsigned, wakelat)[WAKELAT_BUCKETS] = { 0 };
+
+/*
+ * Histogram bucket for a wakeup latency of NSECS.
+ */
+static
+unsigned
+thread_latbucket(uint64_t nsecs)
+{
+	uint64_t usecs;
+	unsigned b;
+
+	usecs = nsecs / 1000;
+	for (b = 0; usecs > 0 && b < WAKELAT_BUCKETS - 1; b++) {
+		usecs >>= 1;
+	}
+	return b;
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -548,6 +1149,7 @@ void
 thread_switch(threadstate_t newstate, struct wchan *wc)
 {
 	struct thread *cur, *next;
+	uint64_t now;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -570,11 +1172,16 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
-	/* Lock the run queue. */
+	/* Switching is a quiescent point for epoch readers. */
+	epoch_quiescent();
+
+	/* Lock the run queue, and pick up any remote wakeups. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
+	thread_wakeq_drain();
 
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue) &&
+	    THREAD_CPU_ALLOWED(cur, curcpu)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -585,10 +1192,27 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
-		thread_make_runnable(cur, true /*have lock*/);
+		if (THREAD_CPU_ALLOWED(cur, curcpu)) {
+			thread_make_runnable(cur, true /*have lock*/);
+		}
+		else {
+			/*
+			 * It can't run here any more. It can't be put
+			 * on another cpu's run queue until we're off
+			 * its stack, so the next thread to run here
+			 * does it; see thread_finish_migration.
+			 */
+			KASSERT(curcpu->c_migrating == NULL);
+			curcpu->c_migrating = cur;
+			cur->t_readysince = SCHED_NOW();
+			cur->t_woken = false;
+		}
 		break;
 	    case S_SLEEP:
-		cur->t_wchan_name = wc->wc_name;
+		/* sleepq_sleep sets its own, more useful, name. */
+		if (cur->t_sleepkey == NULL) {
+			cur->t_wchan_name = wc->wc_name;
+		}
 		/*
 		 * Add the thread to the list in the wait channel, and
 		 * unlock same. To avoid a race with someone else
@@ -611,6 +1235,23 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		break;
 	}
 	cur->t_state = newstate;
+	cur->t_lastrun = curcpu->c_hardclocks;
+
+	/*
+	 * Charge the time it ran. Yielding from an interrupt handler
+	 * means hardclock preempted it; anything else is voluntary.
+	 * (The timestamps are 0 if taken before the clock attached.)
+	 */
+	now = SCHED_NOW();
+	if (cur->t_oncpusince != 0) {
+		cur->t_runtime += now - cur->t_oncpusince;
+	}
+	if (newstate == S_READY && cur->t_in_interrupt) {
+		cur->t_involuntary++;
+	}
+	else {
+		cur->t_voluntary++;
+	}
 
 	/*
 	 * Get the next thread. While there isn't one, call md_idle().
@@ -627,20 +1268,63 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
+	 *
+	 * If we're load balancing by work stealing, try to steal a
+	 * thread from another cpu before idling. We don't take
+	 * hardclocks while idle, so to retry later we depend on busy
+	 * cpus waking us up (see thread_consider_migration).
 	 */
 
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
+		thread_wakeq_drain();
 		next = threadlist_remhead(&curcpu->c_runqueue);
+		if (next == NULL && curcpu->c_migrating == cur) {
+			/*
+			 * We set cur aside to move it, but there's
+			 * nothing else to run here, so we can't get
+			 * off its stack. Run it again instead.
+			 */
+			curcpu->c_migrating = NULL;
+			next = cur;
+		}
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			if (thread_balance_policy == THREAD_BALANCE_STEAL) {
+				next = thread_steal();
+			}
+			if (next == NULL) {
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	/* If hardclock stopped the timer while we were idle, restart it. */
+	if (curcpu->c_hardclock_stopped) {
+		curcpu->c_hardclock_stopped = false;
+		mainbus_start_hardclock();
+	}
+
+	/* Start a fresh timeslice. */
+	next->t_ticksleft = next->t_quantum;
+	if (next != cur) {
+		curcpu->c_switches++;
+	}
+
+	/* Charge the time it waited on the run queue. */
+	now = SCHED_NOW();
+	if (next->t_readysince != 0) {
+		next->t_waittime += now - next->t_readysince;
+		if (next->t_woken) {
+			PERCPU_CUR(wakelat)[thread_latbucket(
+				now - next->t_readysince)]++;
+		}
+	}
+	next->t_oncpusince = now;
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -708,6 +1392,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Unlock the run queue. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
+	/* Send off the previous thread, if it's moving. */
+	thread_finish_migration();
+
 	/* Activate our address space in the MMU. */
 	as_activate();
 
@@ -741,6 +1428,9 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Release the runqueue lock acquired in thread_switch. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
+	/* Send off the previous thread, if it's moving. */
+	thread_finish_migration();
+
 	/* Activate our address space in the MMU. */
 	as_activate();
 
@@ -802,6 +1492,11 @@ thread_exit(void)
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
+	allthreads_remove(cur);
+
+	/* Free any threads that exited before us and weren't cached. */
+	thread_reap();
+
 	/* Interrupts off on this processor */
         splhigh();
 	thread_switch(S_ZOMBIE, NULL);
@@ -817,6 +1512,307 @@ thread_yield(void)
 	thread_switch(S_READY, NULL);
 }
 
+/*
+ * Something for a cpu's worker thread to do; see below.
+ */
+static
+void
+thread_affinity_nudge(void *junk)
+{
+	(void)junk;
+}
+
+/*
+ * Set the current thread's cpu affinity.
+ *
+ * If it's not allowed to run here any more, yielding moves it, but
+ * only if there's something else to run here meanwhile (see
+ * thread_switch). Hand this cpu's worker thread a no-op to make sure
+ * there is.
+ */
+int
+thread_setaffinity(uint32_t mask)
+{
+	unsigned numcpus;
+	uint32_t present;
+
+	/* Keep only the cpus that exist, so the mask reads back sanely. */
+	numcpus = cpu_count();
+	present = numcpus >= 32 ? 0xffffffff : (1U << numcpus) - 1;
+	mask &= present;
+	if (mask == 0) {
+		return EINVAL;
+	}
+
+	curthread->t_affinity = mask;
+	while (!THREAD_CPU_ALLOWED(curthread, curcpu)) {
+		if (curcpu->c_workqueue != NULL) {
+			(void)work_queue(NULL, thread_affinity_nudge, NULL);
+		}
+		thread_yield();
+	}
+	return 0;
+}
+
+uint32_t
+thread_getaffinity(void)
+{
+	return curthread->t_affinity;
+}
+
+/*
+ * Priorities; see thread.h.
+ */
+void
+thread_prilock_acquire(void)
+{
+	spinlock_acquire(&thread_prilock);
+}
+
+void
+thread_prilock_release(void)
+{
+	spinlock_release(&thread_prilock);
+}
+
+void
+thread_setpri(struct thread *t, int pri)
+{
+	struct cpu *c;
+	struct threadlistnode *tln;
+
+	KASSERT(spinlock_do_i_hold(&thread_prilock));
+	KASSERT(pri >= THREAD_PRI_MIN && pri <= THREAD_PRI_MAX);
+
+	/*
+	 * If T is waiting on a run queue, move it to its new place.
+	 * It may be stolen or migrated while we look; if so we won't
+	 * find it, but wherever it goes it's queued by the new value.
+	 */
+	c = t->t_cpu;
+	spinlock_acquire(&c->c_runqueue_lock);
+	t->t_pri = pri;
+	for (tln = c->c_runqueue.tl_head.tln_next; tln->tln_next != NULL;
+	     tln = tln->tln_next) {
+		if (tln->tln_self == t) {
+			threadlist_remove(&c->c_runqueue, t);
+			thread_runqueue_add(c, t);
+			break;
+		}
+	}
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+/*
+ * Set the current thread's base priority. An inherited priority
+ * higher than the new one is kept until our locks are released.
+ */
+void
+thread_setpriority(int pri)
+{
+	KASSERT(pri >= THREAD_PRI_MIN && pri <= THREAD_PRI_MAX);
+
+	spinlock_acquire(&thread_prilock);
+	curthread->t_basepri = pri;
+	if (curthread->t_locksheld == 0 || pri > curthread->t_pri) {
+		thread_setpri(curthread, pri);
+	}
+	spinlock_release(&thread_prilock);
+}
+
+int
+thread_getpriority(void)
+{
+	return curthread->t_pri;
+}
+
+/*
+ * Set the current thread's timeslice length.
+ */
+void
+thread_setquantum(unsigned hardclocks)
+{
+	KASSERT(hardclocks > 0);
+
+	curthread->t_quantum = hardclocks;
+	curthread->t_ticksleft = hardclocks;
+}
+
+/*
+ * Print and reset the per-cpu context switch counters.
+ *
+ * The counters belong to their cpus and are read and cleared here
+ * without locking, so the numbers can be off by a switch or two if
+ * other cpus are busy at the time. That's fine for statistics.
+ */
+void
+thread_printstats(void)
+{
+	time_t nowsecs, secs;
+	uint32_t nownsecs, nsecs;
+	unsigned i, total, switches;
+	unsigned long msecs;
+	struct cpu *c;
+
+	gettime(&nowsecs, &nownsecs);
+	getinterval(stats_secs, stats_nsecs, nowsecs, nownsecs,
+		    &secs, &nsecs);
+	msecs = (unsigned long)secs * 1000 + nsecs / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+
+	kprintf("Context switches over %lu.%03lu seconds:\n",
+		msecs / 1000, msecs % 1000);
+	total = 0;
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		switches = c->c_switches;
+		c->c_switches = 0;
+		total += switches;
+		kprintf("    cpu%u: %10u switches, %10lu/sec\n", c->c_number,
+			switches, (unsigned long)switches * 1000 / msecs);
+	}
+	kprintf("    total: %10u switches, %10lu/sec\n",
+		total, (unsigned long)total * 1000 / msecs);
+
+	stats_secs = nowsecs;
+	stats_nsecs = nownsecs;
+}
+
+/* A thread's accounting as copied out by thread_printsched. */
+struct threadsched {
+	char ts_name[THREAD_NAMELEN];
+	unsigned ts_cpu;
+	uint64_t ts_waittime;
+	uint64_t ts_runtime;
+	unsigned ts_voluntary;
+	unsigned ts_involuntary;
+	unsigned ts_migrations;
+};
+
+/*
+ * Print the scheduler accounting. The threads' numbers are copied
+ * out under allthreads_lock (names truncated to fit), then sorted and
+ * printed. As with thread_printstats, the numbers are read without
+ * the run queue locks and may be slightly stale.
+ */
+void
+thread_printsched(void)
+{
+	struct threadsched *ts, tmp;
+	struct thread *t;
+	unsigned max, num, i, j, b;
+	unsigned wakelat[WAKELAT_BUCKETS];
+	unsigned total;
+	struct cpu *c;
+
+	/* Leave room for threads forked while we allocate. */
+	spinlock_acquire(&allthreads_lock);
+	max = allthreads_count + 8;
+	spinlock_release(&allthreads_lock);
+
+	ts = kmalloc(max * sizeof(*ts));
+	if (ts == NULL) {
+		kprintf("thread_printsched: Out of memory\n");
+		return;
+	}
+
+	num = 0;
+	spinlock_acquire(&allthreads_lock);
+	for (t = allthreads; t != NULL && num < max; t = t->t_allnext) {
+		for (j=0; j<THREAD_NAMELEN-1 && t->t_name[j] != 0; j++) {
+			ts[num].ts_name[j] = t->t_name[j];
+		}
+		ts[num].ts_name[j] = 0;
+		ts[num].ts_cpu = t->t_cpu->c_number;
+		ts[num].ts_waittime = t->t_waittime;
+		ts[num].ts_runtime = t->t_runtime;
+		ts[num].ts_voluntary = t->t_voluntary;
+		ts[num].ts_involuntary = t->t_involuntary;
+		ts[num].ts_migrations = t->t_migrations;
+		num++;
+	}
+	spinlock_release(&allthreads_lock);
+
+	/* Insertion sort, longest waiting first. */
+	for (i=1; i<num; i++) {
+		tmp = ts[i];
+		for (j=i; j>0 && ts[j-1].ts_waittime < tmp.ts_waittime; j--) {
+			ts[j] = ts[j-1];
+		}
+		ts[j] = tmp;
+	}
+
+	kprintf("%-15s %3s %10s %10s %8s %8s %6s\n", "thread", "cpu",
+		"wait(us)", "run(us)", "vol", "invol", "migr");
+	for (i=0; i<num; i++) {
+		kprintf("%-15s %3u %10llu %10llu %8u %8u %6u\n",
+			ts[i].ts_name, ts[i].ts_cpu,
+			ts[i].ts_waittime / 1000, ts[i].ts_runtime / 1000,
+			ts[i].ts_voluntary, ts[i].ts_involuntary,
+			ts[i].ts_migrations);
+	}
+	kfree(ts);
+
+	total = 0;
+	for (b=0; b<WAKELAT_BUCKETS; b++) {
+		wakelat[b] = 0;
+		for (i=0; i<cpuarray_num(&allcpus); i++) {
+			c = cpuarray_get(&allcpus, i);
+			wakelat[b] += PERCPU(wakelat, c)[b];
+		}
+		total += wakelat[b];
+	}
+#if !OPT_SCHEDSTATS
+	kprintf("(Times and wakeup latencies need options schedstats.)\n");
+#endif
+	kprintf("Wakeup latency (%u wakeups):\n", total);
+	for (b=0; b<WAKELAT_BUCKETS; b++) {
+		if (wakelat[b] == 0) {
+			continue;
+		}
+		if (b == 0) {
+			kprintf("    %7s < %7u us: ", "", 1);
+		}
+		else if (b == WAKELAT_BUCKETS - 1) {
+			kprintf("    %7u+         us: ", 1U << (b-1));
+		}
+		else {
+			kprintf("    %7u - %7u us: ", 1U << (b-1), 1U << b);
+		}
+		kprintf("%10u\n", wakelat[b]);
+	}
+}
+
+/*
+ * Clear the scheduler accounting. Like the printing, this doesn't
+ * lock out the cpus doing the counting, so a count or two from
+ * switches happening meanwhile may survive.
+ */
+void
+thread_resetsched(void)
+{
+	struct thread *t;
+	struct cpu *c;
+	unsigned i;
+
+	spinlock_acquire(&allthreads_lock);
+	for (t = allthreads; t != NULL; t = t->t_allnext) {
+		t->t_waittime = 0;
+		t->t_runtime = 0;
+		t->t_voluntary = 0;
+		t->t_involuntary = 0;
+		t->t_migrations = 0;
+	}
+	spinlock_release(&allthreads_lock);
+
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		bzero(PERCPU(wakelat, c), sizeof(percpu__wakelat));
+	}
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -851,6 +1847,14 @@ schedule(void)
  * For here and now, because we know we're running on System/161 and
  * System/161 does not (yet) model such cache effects, we'll be very
  * aggressive.
+ *
+ * This is the push half of load balancing and is only used under
+ * THREAD_BALANCE_PUSH. Under THREAD_BALANCE_STEAL idle cpus pull work
+ * for themselves in thread_switch (see thread_steal), which doesn't
+ * need to lock every cpu's run queue in turn. However, idle cpus
+ * don't get hardclocks, so all we do then is check whether we have
+ * threads waiting and if so poke an idle cpu so it comes and takes
+ * one. As in thread_steal, the unlocked peeks are only hints.
  */
 void
 thread_consider_migration(void)
@@ -861,8 +1865,23 @@ thread_consider_migration(void)
 	struct threadlist victims;
 	struct thread *t;
 
-	my_count = total_count = 0;
 	numcpus = cpuarray_num(&allcpus);
+
+	if (thread_balance_policy == THREAD_BALANCE_STEAL) {
+		if (curcpu->c_runqueue.tl_count == 0) {
+			return;
+		}
+		for (i=0; i<numcpus; i++) {
+			c = cpuarray_get(&allcpus, i);
+			if (c != curcpu->c_self && c->c_isidle) {
+				ipi_send(c, IPI_UNIDLE);
+				break;
+			}
+		}
+		return;
+	}
+
+	my_count = total_count = 0;
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
 		spinlock_acquire(&c->c_runqueue_lock);
@@ -915,16 +1934,18 @@ thread_consider_migration(void)
 			 * Why? And what?) so shuffle it to the end of
 			 * the list and decrement to_send in order to
 			 * skip it. Then it goes back on our own run
-			 * queue below.
+			 * queue below. Threads whose affinity doesn't
+			 * include C are skipped the same way.
 			 */
-			if (t == curthread) {
+			if (t == curthread || !THREAD_CPU_ALLOWED(t, c)) {
 				threadlist_addtail(&victims, t);
 				to_send--;
 				continue;
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			t->t_migrations++;
+			thread_runqueue_add(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -948,7 +1969,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			thread_runqueue_add(curcpu->c_self, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -1031,7 +2052,7 @@ wchan_sleep(struct wchan *wc)
 /*
  * Wake up one thread sleeping on a wait channel.
  */
-void
+struct thread *
 wchan_wakeone(struct wchan *wc)
 {
 	struct thread *target;
@@ -1047,10 +2068,12 @@ wchan_wakeone(struct wchan *wc)
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
-		return;
+		return NULL;
 	}
 
+	thread_wakeup_place(target);
 	thread_make_runnable(target, false);
+	return target;
 }
 
 /*
@@ -1084,6 +2107,7 @@ wchan_wakeall(struct wchan *wc)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
+		thread_wakeup_place(target);
 		thread_make_runnable(target, false);
 	}
 
@@ -1106,6 +2130,185 @@ wchan_isempty(struct wchan *wc)
 	return ret;
 }
 
+////////////////////////////////////////////////////////////
+//
+// Hashed sleep queues; see wchan.h.
+//
+// Each table is an array of ordinary wait channels. A thread sleeping
+// on a key is on the channel the key hashes to, with t_sleepkey set,
+// and the wakeup calls pick out the threads with the right key. The
+// channels are FIFO, so the first match is the longest waiter.
+
+#define SLEEPQ_HASHSIZE 64	/* Channels per table; power of 2 */
+
+static struct wchan sleepqs[SQ_TABLES][SLEEPQ_HASHSIZE];
+
+void
+sleepq_bootstrap(void)
+{
+	static const char *const names[SQ_TABLES] = { "lock", "cv", "futex" };
+	unsigned sq, i;
+
+	for (sq=0; sq<SQ_TABLES; sq++) {
+		for (i=0; i<SLEEPQ_HASHSIZE; i++) {
+			spinlock_init(&sleepqs[sq][i].wc_lock);
+			threadlist_init(&sleepqs[sq][i].wc_threads);
+			sleepqs[sq][i].wc_name = names[sq];
+		}
+	}
+}
+
+static
+struct wchan *
+sleepq_chan(int sq, const void *key)
+{
+	uintptr_t k = (uintptr_t)key;
+
+	KASSERT(sq >= 0 && sq < SQ_TABLES);
+	KASSERT(key != NULL);
+
+	/* Kernel heap objects are at least 8-byte aligned. */
+	return &sleepqs[sq][((k >> 3) ^ (k >> 9)) % SLEEPQ_HASHSIZE];
+}
+
+/*
+ * Remove the first thread sleeping on KEY from WC, which must be
+ * locked.
+ */
+static
+struct thread *
+sleepq_remove(struct wchan *wc, const void *key)
+{
+	struct threadlistnode *tln;
+	struct thread *t;
+
+	for (tln = wc->wc_threads.tl_head.tln_next; tln->tln_next != NULL;
+	     tln = tln->tln_next) {
+		t = tln->tln_self;
+		if (t->t_sleepkey == key) {
+			threadlist_remove(&wc->wc_threads, t);
+			t->t_sleepkey = NULL;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+void
+sleepq_lock(int sq, const void *key)
+{
+	spinlock_acquire(&sleepq_chan(sq, key)->wc_lock);
+}
+
+void
+sleepq_unlock(int sq, const void *key)
+{
+	spinlock_release(&sleepq_chan(sq, key)->wc_lock);
+}
+
+void
+sleepq_sleep(int sq, const void *key, const char *name)
+{
+	struct wchan *wc = sleepq_chan(sq, key);
+
+	/* may not sleep in an interrupt handler */
+	KASSERT(!curthread->t_in_interrupt);
+	KASSERT(spinlock_do_i_hold(&wc->wc_lock));
+
+	curthread->t_wchan_name = name;
+	curthread->t_sleepkey = key;
+	thread_switch(S_SLEEP, wc);
+	KASSERT(curthread->t_sleepkey == NULL);
+}
+
+/*
+ * Like wchan_wakeone, the returned thread may only be looked at
+ * while it can't get anywhere; see the hand-off code in synch.c.
+ */
+struct thread *
+sleepq_wakeone(int sq, const void *key)
+{
+	struct wchan *wc = sleepq_chan(sq, key);
+	struct thread *target;
+
+	spinlock_acquire(&wc->wc_lock);
+	target = sleepq_remove(wc, key);
+	spinlock_release(&wc->wc_lock);
+
+	if (target == NULL) {
+		return NULL;
+	}
+
+	thread_wakeup_place(target);
+	thread_make_runnable(target, false);
+	return target;
+}
+
+void
+sleepq_wakeall(int sq, const void *key)
+{
+	struct wchan *wc = sleepq_chan(sq, key);
+	struct thread *target;
+	struct threadlist list;
+
+	threadlist_init(&list);
+
+	spinlock_acquire(&wc->wc_lock);
+	while ((target = sleepq_remove(wc, key)) != NULL) {
+		threadlist_addtail(&list, target);
+	}
+	spinlock_release(&wc->wc_lock);
+
+	while ((target = threadlist_remhead(&list)) != NULL) {
+		thread_wakeup_place(target);
+		thread_make_runnable(target, false);
+	}
+
+	threadlist_cleanup(&list);
+}
+
+/*
+ * The threads are taken off FROM first and then put on TO, so two
+ * queues are never locked at once and there's no lock ordering to
+ * get wrong. In between, the threads are on neither queue; that's
+ * fine, because nobody can wake them then anyway.
+ */
+unsigned
+sleepq_requeue(int fromsq, const void *from, int tosq, const void *to,
+	       unsigned max)
+{
+	struct wchan *fromwc = sleepq_chan(fromsq, from);
+	struct wchan *towc = sleepq_chan(tosq, to);
+	struct thread *target;
+	struct threadlist list;
+	unsigned n = 0;
+
+	KASSERT(fromsq != tosq || from != to);
+	threadlist_init(&list);
+
+	spinlock_acquire(&fromwc->wc_lock);
+	while (n < max && (target = sleepq_remove(fromwc, from)) != NULL) {
+		threadlist_addtail(&list, target);
+		n++;
+	}
+	spinlock_release(&fromwc->wc_lock);
+
+	if (n == 0) {
+		threadlist_cleanup(&list);
+		return 0;
+	}
+
+	spinlock_acquire(&towc->wc_lock);
+	while ((target = threadlist_remhead(&list)) != NULL) {
+		target->t_sleepkey = to;
+		threadlist_addtail(&towc->wc_threads, target);
+	}
+	spinlock_release(&towc->wc_lock);
+
+	threadlist_cleanup(&list);
+	return n;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -1206,4 +2409,22 @@ interprocessor_interrupt(void)
 
 	curcpu->c_ipi_pending = 0;
 	spinlock_release(&curcpu->c_ipi_lock);
+
+	if (bits & (1U << IPI_WAKEUP)) {
+		/*
+		 * If we were idle, thread_switch will drain the
+		 * wakeup queue. But we might be busy, and the woken
+		 * threads shouldn't have to wait for our next context
+		 * switch.
+		 *
+		 * This has to come after letting go of c_ipi_lock:
+		 * thread_make_runnable sends IPIs while holding a run
+		 * queue lock, so taking ours while holding the IPI
+		 * lock could deadlock against it. A wakeup queued
+		 * since we cleared c_ipi_pending sends another IPI.
+		 */
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+		thread_wakeq_drain();
+		spinlock_release(&curcpu->c_runqueue_lock);
+	}
 }
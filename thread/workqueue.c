@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Per-cpu workqueues. See workqueue.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <workqueue.h>
+
+struct workqueue;
+
+/*
+ * A work item. These live in their workqueue's pool; they're on the
+ * free list, waiting in a timeout (delayed work), on the queue, or
+ * being run.
+ */
+struct work {
+	void (*w_func)(void *);		/* Function to call */
+	void *w_arg;			/* Argument for it */
+	struct workqueue *w_wq;		/* Queue it belongs to */
+	struct timeout w_timeout;	/* Delay for delayed work */
+	time_t w_secs;			/* When it was queued */
+	uint32_t w_nsecs;
+	struct work *w_next;		/* Link for queue or free list */
+};
+
+struct workqueue {
+	struct cpu *wq_cpu;		/* Cpu whose worker runs this */
+	struct spinlock wq_lock;	/* Protects everything below */
+	struct wchan *wq_wchan;		/* Worker waits here */
+	struct work *wq_head;		/* Work to do, in order */
+	struct work **wq_tailp;
+	struct work *wq_free;		/* Free work items */
+	struct work wq_pool[WORKQ_POOLSIZE];
+
+	/* Statistics, since the last workqueue_printstats */
+	unsigned wq_depth;		/* Items on the queue now */
+	unsigned wq_maxdepth;		/* ... and the most there were */
+	unsigned wq_queued;		/* Items queued */
+	unsigned wq_ran;		/* Items run */
+	unsigned wq_dropped;		/* Items refused for lack of space */
+	unsigned wq_totallat;		/* Total latency (us) */
+	unsigned wq_maxlat;		/* Worst latency (us) */
+};
+
+static bool workqueues_started;
+
+////////////////////////////////////////////////////////////
+// work items
+
+/*
+ * Get a free work item from WQ.
+ */
+static
+struct work *
+work_alloc(struct workqueue *wq, void (*func)(void *), void *arg)
+{
+	struct work *w;
+
+	spinlock_acquire(&wq->wq_lock);
+	w = wq->wq_free;
+	if (w == NULL) {
+		wq->wq_dropped++;
+		spinlock_release(&wq->wq_lock);
+		return NULL;
+	}
+	wq->wq_free = w->w_next;
+	spinlock_release(&wq->wq_lock);
+
+	w->w_func = func;
+	w->w_arg = arg;
+	w->w_next = NULL;
+	return w;
+}
+
+/*
+ * Put a work item on the end of its queue and poke the worker.
+ */
+static
+void
+work_enqueue(struct work *w)
+{
+	struct workqueue *wq = w->w_wq;
+
+	gettime(&w->w_secs, &w->w_nsecs);
+
+	spinlock_acquire(&wq->wq_lock);
+	*wq->wq_tailp = w;
+	wq->wq_tailp = &w->w_next;
+	wq->wq_depth++;
+	if (wq->wq_depth > wq->wq_maxdepth) {
+		wq->wq_maxdepth = wq->wq_depth;
+	}
+	wq->wq_queued++;
+	wchan_wakeone(wq->wq_wchan);
+	spinlock_release(&wq->wq_lock);
+}
+
+/*
+ * Timeout callback for delayed work.
+ */
+static
+void
+work_delay_done(void *data)
+{
+	work_enqueue(data);
+}
+
+static
+struct workqueue *
+workqueue_get(struct cpu *c)
+{
+	KASSERT(workqueues_started);
+
+	if (c == NULL) {
+		c = curcpu->c_self;
+	}
+	KASSERT(c->c_workqueue != NULL);
+	return c->c_workqueue;
+}
+
+int
+work_queue(struct cpu *c, void (*func)(void *), void *arg)
+{
+	struct work *w;
+
+	w = work_alloc(workqueue_get(c), func, arg);
+	if (w == NULL) {
+		return ENOMEM;
+	}
+	work_enqueue(w);
+	return 0;
+}
+
+int
+work_queue_delayed(struct cpu *c, void (*func)(void *), void *arg,
+		   unsigned ticks)
+{
+	struct work *w;
+
+	w = work_alloc(workqueue_get(c), func, arg);
+	if (w == NULL) {
+		return ENOMEM;
+	}
+	timeout_init(&w->w_timeout, work_delay_done, w);
+	timeout_add(&w->w_timeout, ticks);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// worker threads
+
+/*
+ * The worker for one cpu. Takes items off the front of the queue
+ * and runs them, until the end of time.
+ */
+static
+void
+workqueue_thread(void *data, unsigned long junk)
+{
+	struct workqueue *wq = data;
+	struct work *w;
+	void (*func)(void *);
+	void *arg;
+	time_t secs;
+	uint32_t nsecs;
+	unsigned lat;
+
+	(void)junk;
+
+	KASSERT(curcpu->c_self == wq->wq_cpu);
+
+	while (1) {
+		spinlock_acquire(&wq->wq_lock);
+		while (wq->wq_head == NULL) {
+			wchan_lock(wq->wq_wchan);
+			spinlock_release(&wq->wq_lock);
+			wchan_sleep(wq->wq_wchan);
+			spinlock_acquire(&wq->wq_lock);
+		}
+		w = wq->wq_head;
+		wq->wq_head = w->w_next;
+		if (wq->wq_head == NULL) {
+			wq->wq_tailp = &wq->wq_head;
+		}
+		wq->wq_depth--;
+		spinlock_release(&wq->wq_lock);
+
+		gettime(&secs, &nsecs);
+		getinterval(w->w_secs, w->w_nsecs, secs, nsecs,
+			    &secs, &nsecs);
+		lat = secs * 1000000 + nsecs / 1000;
+
+		/* Free the item before running it, so it can requeue. */
+		func = w->w_func;
+		arg = w->w_arg;
+		spinlock_acquire(&wq->wq_lock);
+		w->w_next = wq->wq_free;
+		wq->wq_free = w;
+		wq->wq_ran++;
+		wq->wq_totallat += lat;
+		if (lat > wq->wq_maxlat) {
+			wq->wq_maxlat = lat;
+		}
+		spinlock_release(&wq->wq_lock);
+
+		func(arg);
+	}
+}
+
+static
+struct workqueue *
+workqueue_create(struct cpu *c)
+{
+	struct workqueue *wq;
+	char name[16];
+	unsigned i;
+
+	wq = kmalloc(sizeof(*wq));
+	if (wq == NULL) {
+		return NULL;
+	}
+	snprintf(name, sizeof(name), "work%u", c->c_number);
+	wq->wq_wchan = wchan_create(name);
+	if (wq->wq_wchan == NULL) {
+		kfree(wq);
+		return NULL;
+	}
+	wq->wq_cpu = c;
+	spinlock_init(&wq->wq_lock);
+	wq->wq_head = NULL;
+	wq->wq_tailp = &wq->wq_head;
+	wq->wq_free = NULL;
+	for (i=0; i<WORKQ_POOLSIZE; i++) {
+		wq->wq_pool[i].w_wq = wq;
+		wq->wq_pool[i].w_next = wq->wq_free;
+		wq->wq_free = &wq->wq_pool[i];
+	}
+	wq->wq_depth = wq->wq_maxdepth = 0;
+	wq->wq_queued = wq->wq_ran = wq->wq_dropped = 0;
+	wq->wq_totallat = wq->wq_maxlat = 0;
+	return wq;
+}
+
+/*
+ * Set up a workqueue and worker thread for each cpu. Must be called
+ * after all the cpus are started.
+ */
+void
+workqueue_bootstrap(void)
+{
+	struct workqueue *wq;
+	struct cpu *c;
+	char name[16];
+	unsigned i;
+	int result;
+
+	for (i=0; i<cpu_count(); i++) {
+		c = cpu_get(i);
+		wq = workqueue_create(c);
+		if (wq == NULL) {
+			panic("workqueue_bootstrap: Out of memory\n");
+		}
+		c->c_workqueue = wq;
+
+		snprintf(name, sizeof(name), "<worker #%u>", i);
+		result = thread_fork_pinned(name, c, workqueue_thread, wq, 0);
+		if (result) {
+			panic("workqueue_bootstrap: thread_fork_pinned: %s\n",
+			      strerror(result));
+		}
+	}
+	workqueues_started = true;
+}
+
+////////////////////////////////////////////////////////////
+// statistics
+
+/*
+ * Print and reset the per-cpu workqueue statistics. The max depth
+ * starts over from the current depth.
+ */
+void
+workqueue_printstats(void)
+{
+	struct workqueue *wq;
+	unsigned queued, ran, dropped, depth, maxdepth, totallat, maxlat;
+	unsigned i;
+
+	kprintf("cpu   queued      ran  dropped  depth  max  "
+		"avg lat(us)  max lat(us)\n");
+	for (i=0; i<cpu_count(); i++) {
+		wq = cpu_get(i)->c_workqueue;
+		if (wq == NULL) {
+			continue;
+		}
+
+		/* Copy them out, since kprintf can sleep. */
+		spinlock_acquire(&wq->wq_lock);
+		queued = wq->wq_queued;
+		ran = wq->wq_ran;
+		dropped = wq->wq_dropped;
+		depth = wq->wq_depth;
+		maxdepth = wq->wq_maxdepth;
+		totallat = wq->wq_totallat;
+		maxlat = wq->wq_maxlat;
+		wq->wq_queued = wq->wq_ran = wq->wq_dropped = 0;
+		wq->wq_maxdepth = wq->wq_depth;
+		wq->wq_totallat = wq->wq_maxlat = 0;
+		spinlock_release(&wq->wq_lock);
+
+		kprintf("%3u %8u %8u %8u %6u %4u %12u %12u\n", i,
+			queued, ran, dropped, depth, maxdepth,
+			ran ? totallat / ran : 0, maxlat);
+	}
+}
@@ -87,6 +87,13 @@ DEFARRAY(knowndev, /*no inline*/);
 
 static struct knowndevarray *knowndevs;
 
+/*
+ * Protects knowndevs and the kd_fs fields in it, so lookups don't
+ * need to serialize on vfs_biglock. Changes are made while also
+ * holding vfs_biglock; the big lock always comes first.
+ */
+static struct rwlock *knowndevs_lock;
+
 /* The big lock for all FS ops. Remove for filesystem assignment. */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
@@ -102,6 +109,10 @@ vfs_bootstrap(void)
 	if (knowndevs==NULL) {
 		panic("vfs: Could not create knowndevs array\n");
 	}
+	knowndevs_lock = rwlock_create("knowndevs");
+	if (knowndevs_lock==NULL) {
+		panic("vfs: Could not create knowndevs lock\n");
+	}
 
 	vfs_biglock = lock_create("vfs_biglock");
 	if (vfs_biglock==NULL) {
@@ -171,16 +182,15 @@ vfs_sync(void)
 
 /*
  * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
- * back an appropriate vnode.
+ * back an appropriate vnode. knowndevs_lock must be held.
  */
+static
 int
-vfs_getroot(const char *devname, struct vnode **result)
+vfs_dogetroot(const char *devname, struct vnode **result)
 {
 	struct knowndev *kd;
 	unsigned i, num;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -250,6 +260,24 @@ vfs_getroot(const char *devname, struct vnode **result)
 	return ENODEV;
 }
 
+/*
+ * The search only needs the read lock. We still need the big lock
+ * because FSOP_GETROOT may take it, and it has to come first.
+ */
+int
+vfs_getroot(const char *devname, struct vnode **result)
+{
+	int err;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	rwlock_acquire_read(knowndevs_lock);
+	err = vfs_dogetroot(devname, result);
+	rwlock_release(knowndevs_lock);
+
+	return err;
+}
+
 /*
  * Given a filesystem, hand back the name of the device it's mounted on.
  */
@@ -261,8 +289,7 @@ vfs_getdevname(struct fs *fs)
 
 	KASSERT(fs != NULL);
 
-	KASSERT(vfs_biglock_do_i_hold());
-
+	rwlock_acquire_read(knowndevs_lock);
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -274,9 +301,11 @@ vfs_getdevname(struct fs *fs)
 			 * the fs cannot go away, and the device can't
 			 * go away until the fs goes away.
 			 */
+			rwlock_release(knowndevs_lock);
 			return kd->kd_name;
 		}
 	}
+	rwlock_release(knowndevs_lock);
 
 	return NULL;
 }
@@ -411,12 +440,16 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		volname = FSOP_GETVOLNAME(fs);
 	}
 
+	rwlock_acquire_write(knowndevs_lock);
+
 	if (badnames(name, rawname, volname)) {
+		rwlock_release(knowndevs_lock);
 		vfs_biglock_release();
 		return EEXIST;
 	}
 
 	result = knowndevarray_add(knowndevs, kd, &index);
+	rwlock_release(knowndevs_lock);
 
 	if (result == 0 && dev != NULL) {
 		/* use index+1 as the device number, so 0 is reserved */
@@ -470,7 +503,8 @@ vfs_addfs(const char *devname, struct fs *fs)
 
 /*
  * Look for a mountable device named DEVNAME.
- * Should already hold knowndevs_lock.
+ * Should already hold vfs_biglock (all changes to knowndevs are
+ * made under it, so we don't need knowndevs_lock as well).
  */
 static
 int
@@ -537,7 +571,9 @@ vfs_mount(const char *devname, void *data,
 
 	KASSERT(fs != NULL);
 
+	rwlock_acquire_write(knowndevs_lock);
 	kd->kd_fs = fs;
+	rwlock_release(knowndevs_lock);
 
 	volname = FSOP_GETVOLNAME(fs);
 	kprintf("vfs: Mounted %s: on %s\n",
@@ -584,7 +620,9 @@ vfs_unmount(const char *devname)
 	kprintf("vfs: Unmounted %s:\n", kd->kd_name);
 
 	/* now drop the filesystem */
+	rwlock_acquire_write(knowndevs_lock);
 	kd->kd_fs = NULL;
+	rwlock_release(knowndevs_lock);
 
 	KASSERT(result==0);
 
@@ -647,7 +685,9 @@ vfs_unmountall(void)
 		}
 
 		/* now drop the filesystem */
+		rwlock_acquire_write(knowndevs_lock);
 		dev->kd_fs = NULL;
+		rwlock_release(knowndevs_lock);
 	}
 
 	vfs_biglock_release();